@@ -0,0 +1,334 @@
+/*
+author          Oliver Blaser
+date            18.10.2026
+copyright       MIT - Copyright (c) 2026 Oliver Blaser
+*/
+
+#ifndef IG_CURLTHREAD_CORO_H
+#define IG_CURLTHREAD_CORO_H
+
+#if defined(_MSVC_LANG)
+#define CURLTHREAD_CORO_CPPSTD (_MSVC_LANG)
+#else
+#define CURLTHREAD_CORO_CPPSTD (__cplusplus)
+#endif
+
+#if (CURLTHREAD_CORO_CPPSTD >= 202002L) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define CURLTHREAD_CORO_AVAILABLE (1)
+#endif
+#endif
+
+#if defined(CURLTHREAD_CORO_AVAILABLE)
+
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include "../curl-thread/curl.h"
+#include "../curl-thread/types.h"
+
+
+/**
+ * @brief C++20 coroutine interface.
+ *
+ * Only available if compiled as C++20 or later, the rest of the library stays C++11.
+ *
+ * @code
+ * curl::coro::Task fetchTime(curl::coro::Client& client)
+ * {
+ *     const curl::Response res = co_await client.fetch(curl::GetRequest("https://example.com/"));
+ *     ...
+ * }
+ * @endcode
+ *
+ * The awaiting coroutine is suspended while the request is queued and performed, no thread is blocked. It is resumed
+ * by the executor of the client. Destroying a suspended coroutine cancels its request (see `curl::cancelRequest()`).
+ */
+namespace curl {
+namespace coro {
+
+    /**
+     * @brief Runs the passed job, e.g. by posting it to an event loop.
+     */
+    using Executor = std::function<void(std::function<void()>)>;
+
+    /**
+     * @brief Runs the job immediately, i.e. the coroutine is resumed on the curl thread.
+     *
+     * The coroutine should then not do much work before its next suspension point, as it holds off the next request.
+     */
+    static inline Executor inlineExecutor()
+    {
+        return [](std::function<void()> job) { job(); };
+    }
+
+    /**
+     * @brief Simple executor which resumes the coroutines on the thread which calls `poll()`.
+     *
+     * The executors returned by `executor()` share the job queue, jobs which are posted after this object has been
+     * destroyed are dropped.
+     */
+    class LoopExecutor
+    {
+    private:
+        struct Queue
+        {
+            std::mutex mtx;
+            std::deque<std::function<void()>> jobs;
+            bool closed = false;
+        };
+
+    public:
+        LoopExecutor()
+            : m_queue(std::make_shared<Queue>())
+        {}
+
+        virtual ~LoopExecutor()
+        {
+            // the jobs may hold executors which refer to the queue
+            std::deque<std::function<void()>> jobs;
+
+            std::lock_guard<std::mutex> lg(m_queue->mtx);
+            m_queue->closed = true;
+            jobs.swap(m_queue->jobs);
+        }
+
+        void post(std::function<void()> job) { m_post(*m_queue, std::move(job)); }
+
+        /**
+         * @brief Runs the posted jobs.
+         *
+         * @return Number of jobs which have been run
+         */
+        size_t poll()
+        {
+            std::deque<std::function<void()>> jobs;
+
+            {
+                std::lock_guard<std::mutex> lg(m_queue->mtx);
+                jobs.swap(m_queue->jobs);
+            }
+
+            for (size_t i = 0; i < jobs.size(); ++i) { jobs[i](); }
+
+            return jobs.size();
+        }
+
+        Executor executor() const
+        {
+            const std::shared_ptr<Queue> queue = m_queue;
+            return [queue](std::function<void()> job) { m_post(*queue, std::move(job)); };
+        }
+
+    private:
+        std::shared_ptr<Queue> m_queue;
+
+        static void m_post(Queue& queue, std::function<void()> job)
+        {
+            std::lock_guard<std::mutex> lg(queue.mtx);
+            if (!queue.closed) { queue.jobs.push_back(std::move(job)); }
+        }
+    };
+
+    /**
+     * @brief Returned by `curl::coro::Client::fetch()`, to be `co_await`ed once.
+     *
+     * Results in the `curl::Response` of the request. If the request could not be queued, the response code is
+     * `curl::Response::E_NOT_QUEUED`.
+     */
+    class FetchAwaiter
+    {
+    private:
+        // shared with the completion handler, which may run after the awaiter has been destroyed
+        struct State
+        {
+            std::mutex mtx;
+            bool done = false;
+            bool cancelled = false;
+            curl::QueueId id;
+            curl::Response response;
+            std::coroutine_handle<> handle;
+            Executor exec;
+        };
+
+    public:
+        FetchAwaiter(curl::ThreadSharedData& sd, const Executor& exec, const curl::Request& req, const curl::Priority& priority)
+            : m_sd(&sd), m_request(req), m_priority(priority), m_state(std::make_shared<State>())
+        {
+            m_state->exec = exec;
+        }
+
+        FetchAwaiter(const FetchAwaiter&) = delete;
+        FetchAwaiter& operator=(const FetchAwaiter&) = delete;
+
+        FetchAwaiter(FetchAwaiter&& other) noexcept
+            : m_sd(other.m_sd), m_request(std::move(other.m_request)), m_priority(other.m_priority), m_state(std::move(other.m_state))
+        {}
+
+        virtual ~FetchAwaiter() { m_cancel(); }
+
+        bool await_ready() const noexcept { return false; }
+
+        bool await_suspend(std::coroutine_handle<> handle)
+        {
+            // once queued, the coroutine may be resumed and this awaiter destroyed, only locals are used from there on
+            const std::shared_ptr<State> state = m_state;
+            state->handle = handle;
+
+            const curl::QueueId id = m_sd->queueRequest(m_request, m_priority, [state](const curl::Response& res) {
+                {
+                    std::lock_guard<std::mutex> lg(state->mtx);
+                    state->done = true;
+                    if (state->cancelled) { return; }
+                    state->response = res;
+                }
+
+                state->exec([state]() {
+                    {
+                        std::lock_guard<std::mutex> lg(state->mtx);
+                        if (state->cancelled) { return; }
+                    }
+
+                    state->handle.resume();
+                });
+            });
+
+            std::lock_guard<std::mutex> lg(state->mtx);
+
+            if (!id.isValid())
+            {
+                state->done = true;
+                state->response = curl::Response(curl::Response::E_NOT_QUEUED, -1, "");
+                return false;
+            }
+
+            state->id = id;
+            return true;
+        }
+
+        curl::Response await_resume()
+        {
+            std::lock_guard<std::mutex> lg(m_state->mtx);
+            return std::move(m_state->response);
+        }
+
+    private:
+        curl::ThreadSharedData* m_sd;
+        curl::Request m_request;
+        curl::Priority m_priority;
+        std::shared_ptr<State> m_state;
+
+        void m_cancel()
+        {
+            if (!m_state) { return; }
+
+            // cancelled under the lock, so that the completion handler can't finish in between and release the ID
+            std::lock_guard<std::mutex> lg(m_state->mtx);
+            m_state->cancelled = true;
+            if (!m_state->done && m_state->id.isValid()) { m_sd->cancelRequest(m_state->id); }
+        }
+    };
+
+    class Client
+    {
+    public:
+        /**
+         * @param exec Executor on which the awaiting coroutines are resumed, see `curl::coro::inlineExecutor()`
+         * @param sd Shared data of the curl thread
+         */
+        explicit Client(const Executor& exec = inlineExecutor(), curl::ThreadSharedData& sd = curl::sharedData)
+            : m_exec(exec), m_sd(&sd)
+        {}
+
+        virtual ~Client() {}
+
+        FetchAwaiter fetch(const curl::Request& req, const curl::Priority& priority = curl::Priority::normal) const
+        {
+            return FetchAwaiter(*m_sd, m_exec, req, priority);
+        }
+
+    private:
+        Executor m_exec;
+        curl::ThreadSharedData* m_sd;
+    };
+
+    /**
+     * @brief Minimal coroutine type for fire and forget tasks.
+     *
+     * Starts eagerly and stays suspended at its end until the task is destroyed. Destroying a task which is suspended
+     * at a `co_await` cancels the request it's waiting for. An exception leaving the coroutine is rethrown by `get()`.
+     */
+    class Task
+    {
+    public:
+        struct promise_type
+        {
+            std::exception_ptr exception;
+
+            Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_always final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { exception = std::current_exception(); }
+        };
+
+    public:
+        Task()
+            : m_handle()
+        {}
+
+        Task(const Task&) = delete;
+        Task& operator=(const Task&) = delete;
+
+        Task(Task&& other) noexcept
+            : m_handle(std::exchange(other.m_handle, nullptr))
+        {}
+
+        Task& operator=(Task&& other) noexcept
+        {
+            if (this != &other)
+            {
+                m_destroy();
+                m_handle = std::exchange(other.m_handle, nullptr);
+            }
+            return *this;
+        }
+
+        virtual ~Task() { m_destroy(); }
+
+        /**
+         * @brief Not thread safe, must be called on the thread the coroutine is resumed on.
+         */
+        bool done() const { return (!m_handle || m_handle.done()); }
+
+        void get() const
+        {
+            if (m_handle && m_handle.promise().exception) { std::rethrow_exception(m_handle.promise().exception); }
+        }
+
+    private:
+        explicit Task(std::coroutine_handle<promise_type> handle)
+            : m_handle(handle)
+        {}
+
+        std::coroutine_handle<promise_type> m_handle;
+
+        void m_destroy()
+        {
+            if (m_handle) { m_handle.destroy(); }
+            m_handle = nullptr;
+        }
+    };
+
+} // namespace coro
+} // namespace curl
+
+#endif // CURLTHREAD_CORO_AVAILABLE
+
+
+#endif // IG_CURLTHREAD_CORO_H
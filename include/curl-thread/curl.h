@@ -7,12 +7,22 @@ copyright       MIT - Copyright (c) 2025 Oliver Blaser
 #ifndef IG_CURLTHREAD_CURL_H
 #define IG_CURLTHREAD_CURL_H
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
-#include <queue>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
+#include "../curl-thread/requestqueue.h"
+#include "../curl-thread/spool.h"
+#include "../curl-thread/spscring.h"
 #include "../curl-thread/thread.h"
+#include "../curl-thread/timerwheel.h"
 #include "../curl-thread/types.h"
 
 
@@ -32,9 +42,53 @@ copyright       MIT - Copyright (c) 2025 Oliver Blaser
  */
 namespace curl {
 
-class ThreadSharedData : public thread::ThreadCtl
+/**
+ * @brief Called on the curl thread when the response of a request is ready, see `curl::queueRequest(const curl::Request&, const curl::Priority&, const curl::CompletionHandler&)`.
+ */
+using CompletionHandler = std::function<void(const curl::Response&)>;
+
+class CompletionQueue;
+using CompletionQueuePtr = std::shared_ptr<curl::CompletionQueue>;
+
+/**
+ * @brief Default queue policy of `curl::BasicThreadSharedData`, used by `curl::sharedData`.
+ */
+struct ThreadQueuePolicy : public curl::QueuePolicy
+{
+    static constexpr int capacity = curl::QueueId::MAX;
+    static constexpr int priorityLevels = (int)curl::Priority::max + 1;
+    using index_type = int16_t;
+    using mutex_type = curl::NullLock; // guarded by the mutex of the shared data
+};
+
+/**
+ * @brief Queue policy with 5 IDs which prints the acquired IDs on every acquire and release.
+ */
+struct DebugQueuePolicy : public curl::ThreadQueuePolicy
 {
+    static constexpr int capacity = 5;
+    static constexpr bool debugHooks = true;
+
+    static void debugHook(const char* event, int id, const std::string& acquired);
+};
+
+/**
+ * @brief Data shared between the curl thread and the threads which queue requests.
+ *
+ * The queue policy sets the shape of the request queue, see `curl::QueuePolicy`. Its capacity can't exceed
+ * `curl::QueueId::MAX`. The members are defined in curl.cpp, which instantiates the template for
+ * `curl::ThreadQueuePolicy` and `curl::DebugQueuePolicy`, other policies have to be instantiated there too.
+ * `curl::thread()` and the free functions use `curl::sharedData`, which has the default policy.
+ *
+ * @tparam Policy See `curl::QueuePolicy`
+ */
+template <class Policy = curl::ThreadQueuePolicy> class BasicThreadSharedData : public thread::ThreadCtl
+{
+    static_assert((Policy::capacity > 0) && (Policy::capacity <= curl::QueueId::MAX), "the IDs have to be valid queue IDs");
+
 public:
+    using policy_type = Policy;
+
     class QueueItem
     {
     public:
@@ -46,6 +100,11 @@ public:
 
         virtual ~QueueItem() {}
 
+        QueueItem(const QueueItem& other) = default;
+        QueueItem(QueueItem&& other) = default;
+        QueueItem& operator=(const QueueItem& other) = default;
+        QueueItem& operator=(QueueItem&& other) = default;
+
         virtual void clear() { m_queueId = QueueId::NONE; }
 
         const QueueId& queueId() const { return m_queueId; }
@@ -55,37 +114,79 @@ public:
     };
 
     class Request : public curl::Request,
-                    public ThreadSharedData::QueueItem
+                    public BasicThreadSharedData::QueueItem
     {
     public:
         Request()
-            : curl::Request(Method::GET, ""), ThreadSharedData::QueueItem(QueueId::NONE)
+            : curl::Request(Method::GET, ""), BasicThreadSharedData::QueueItem(QueueId::NONE), m_priority(Priority::normal), m_attempt(0)
         {}
 
-        Request(const curl::Request& other, const QueueId& queueId)
-            : curl::Request(other), ThreadSharedData::QueueItem(queueId)
+        Request(const curl::Request& other, const QueueId& queueId, const Priority& priority = Priority::normal)
+            : curl::Request(other), BasicThreadSharedData::QueueItem(queueId), m_priority(priority), m_attempt(0)
         {}
 
         virtual ~Request() {}
+
+        Request(const Request& other) = default;
+        Request(Request&& other) = default;
+        Request& operator=(const Request& other) = default;
+        Request& operator=(Request&& other) = default;
+
+        /**
+         * @brief Same as constructing a new request, but reuses the buffers of this one.
+         */
+        void assign(const curl::Request& other, const QueueId& queueId, const Priority& priority)
+        {
+            curl::Request::operator=(other);
+            BasicThreadSharedData::QueueItem::operator=(BasicThreadSharedData::QueueItem(queueId));
+            m_priority = priority;
+            m_attempt = 0;
+        }
+
+        const Priority& priority() const { return m_priority; }
+
+        /**
+         * @brief Number of performed attempts.
+         */
+        int attempt() const { return m_attempt; }
+        void incAttempt() { ++m_attempt; }
+
+    private:
+        Priority m_priority;
+        int m_attempt;
     };
 
     class Response : public curl::Response,
-                     public ThreadSharedData::QueueItem
+                     public BasicThreadSharedData::QueueItem
     {
     public:
         Response()
-            : curl::Response(), ThreadSharedData::QueueItem(QueueId::NONE)
+            : curl::Response(), BasicThreadSharedData::QueueItem(QueueId::NONE)
         {}
 
         Response(const curl::Response& other, const QueueId& queueId)
-            : curl::Response(other), ThreadSharedData::QueueItem(queueId)
+            : curl::Response(other), BasicThreadSharedData::QueueItem(queueId)
         {}
 
         virtual ~Response() {}
 
+        Response(const Response& other) = default;
+        Response(Response&& other) = default;
+        Response& operator=(const Response& other) = default;
+        Response& operator=(Response&& other) = default;
+
+        /**
+         * @brief Same as constructing a new response, but reuses the buffers of this one.
+         */
+        void assign(const curl::Response& other, const QueueId& queueId)
+        {
+            curl::Response::operator=(other);
+            BasicThreadSharedData::QueueItem::operator=(BasicThreadSharedData::QueueItem(queueId));
+        }
+
         virtual void clear()
         {
-            ThreadSharedData::QueueItem::clear();
+            BasicThreadSharedData::QueueItem::clear();
             curl::Response::m_clear();
         }
     };
@@ -93,59 +194,625 @@ public:
 
 
 public:
-    ThreadSharedData()
-        : thread::ThreadCtl()
+    BasicThreadSharedData()
+        : thread::ThreadCtl(), m_slots(), m_timerSeq(0), m_rateLimits(), m_rateLimitGen(1), m_throttleWait_ms(-1), m_breakerConfig(), m_budget(), m_charges(),
+          m_budgetUsed(), m_budgetCv(), m_shedConfig(), m_shed(), m_cancelled(), m_inFlight(), m_routes(), m_defaultQueue(), m_drainDeadline_ms(-1), m_warmUp(),
+          m_workCv(), m_wake(false), m_hedgeRatio(0.1), m_hedgeBurst(10), m_hedgeTokens(10), m_latencies(), m_batchers(), m_batches(), m_spoolConfig(),
+          m_spool(), m_spoolSeq(), m_stats(), m_response(), m_responseId(QueueId::NONE), m_qDelayedSize(0), m_scheduledCount(0), m_shards(), m_shardConfig(),
+          m_shardIds(0), m_sharded(false), m_shardingEnabled(false), m_shardLevels(0), m_shardPending(0), m_workerWaiting(false)
     {}
 
-    virtual ~ThreadSharedData() {}
+    virtual ~BasicThreadSharedData() {}
 
 
+    void shutdown();
+    void shutdown(const std::chrono::milliseconds& drainTimeout);
+    void warmUp(const std::vector<std::string>& origins);
+
     // clang-format off
     curl::QueueId queueRequest(const curl::Request& req, const curl::Priority& priority);
-    bool responseReady(const curl::QueueId& queueId) const { lock_guard lg(m_mtx); return (queueId == m_response.queueId()); }
+    curl::QueueId queueRequest(const curl::Request& req, const curl::Priority& priority, const std::chrono::milliseconds& timeout);
+    curl::QueueId queueRequest(const curl::Request& req, const curl::Priority& priority, const curl::CompletionHandler& handler);
+    curl::QueueId queueRequest(const curl::Request& req, const curl::Priority& priority, const curl::Delivery& delivery);
+    curl::QueueId queueRequest(const curl::Request& req, const curl::Priority& priority, const curl::CompletionQueuePtr& queue);
+    bool cancelRequest(const curl::QueueId& queueId);
+    curl::QueueId scheduleRequest(const curl::Request& req, const curl::Priority& priority, const std::chrono::steady_clock::time_point& at);
+    curl::QueueId scheduleRecurring(const curl::Request& req, const curl::Priority& priority, const std::chrono::milliseconds& interval, const std::chrono::milliseconds& jitter = std::chrono::milliseconds(0));
+    bool cancelSchedule(const curl::QueueId& queueId);
+    void setRateLimit(const std::string& hostOrPrefix, double rate, double burst);
+    bool removeRateLimit(const std::string& hostOrPrefix);
+    void setCircuitBreaker(const curl::CircuitBreakerConfig& config) { lock_guard lg(m_mtx); m_breakerConfig = config; }
+    void setByteBudget(const curl::ByteBudget& budget);
+    void setLoadShedding(const curl::ShedConfig& config) { lock_guard lg(m_mtx); m_suspendShards(); m_shedConfig = config; m_updateShardLevels(); }
+    void setHedgeLimit(double ratio, double burst);
+    void setBatching(const std::string& url, const curl::BatchConfig& config);
+    bool removeBatching(const std::string& url);
+    int openSpool(const std::string& filename, const curl::SpoolConfig& config);
+    bool setSharding(const curl::ShardConfig& config);
+    curl::Stats getStats() const;
+    bool responseReady(const curl::QueueId& queueId) const { return (queueId == m_responseId.load(std::memory_order_acquire)); }
     curl::Response popResponse();
-
-    size_t getQNormalSize() const { lock_guard lg(m_mtx); return m_qNormal.size(); }
-    size_t getQHighSize() const { lock_guard lg(m_mtx); return m_qHigh.size(); }
-    size_t getQMaxSize() const { lock_guard lg(m_mtx); return m_qMax.size(); }
+    void popResponse(curl::Response& res);
+    int completionFd();
+    std::vector<curl::Completion> drainCompletions();
+
+    size_t getQNormalSize() const { return m_slots.loadSize((int)Priority::normal) + m_shardedSize(Priority::normal); }
+    size_t getQHighSize() const { return m_slots.loadSize((int)Priority::high) + m_shardedSize(Priority::high); }
+    size_t getQMaxSize() const { return m_slots.loadSize((int)Priority::max) + m_shardedSize(Priority::max); }
+    size_t getQDelayedSize() const { return m_qDelayedSize.load(std::memory_order_relaxed); }
+    size_t getScheduledCount() const { return m_scheduledCount.load(std::memory_order_relaxed); }
     // clang-format on
 
 
 private:
-    std::queue<ThreadSharedData::Request> m_qNormal;
-    std::queue<ThreadSharedData::Request> m_qHigh;
-    std::queue<ThreadSharedData::Request> m_qMax;
-    std::vector<curl::QueueId::id_type> m_queueId;
+    /**
+     * Timers refer to a delayed or scheduled request by its queue ID. The sequence number identifies the timer, a timer
+     * whose sequence number doesn't match the one of the request it refers to has been cancelled.
+     */
+    struct TimerRef
+    {
+        curl::QueueId::id_type id;
+        uint64_t seq;
+    };
+
+    struct Scheduled
+    {
+        BasicThreadSharedData::Request request;
+        uint64_t timerSeq;
+        int64_t base_ms;     // due time without jitter
+        int64_t interval_ms; // 0 if it's not recurring
+        int64_t jitter_ms;
+        bool pending; // a firing has been queued and is not yet popped
+    };
+
+    struct Delayed
+    {
+        BasicThreadSharedData::Request request;
+        uint64_t timerSeq;
+    };
+
+    struct TokenBucket
+    {
+        std::string match; // host, or URL prefix if it contains a scheme
+        bool urlPrefix;
+        double rate;  // tokens per second
+        double burst; // capacity
+        double tokens;
+        int64_t t_ms; // time of the last refill
+
+        bool take(int64_t now_ms, long* wait_ms);
+    };
+
+    struct Breaker
+    {
+        curl::CircuitState state;
+        int consecutiveFailures;
+        std::deque<bool> window; // outcomes of the last requests, true if failed
+        int windowFailures;
+        int probes; // requests in flight while half open
+        int64_t openedAt_ms;
+        uint64_t rejected;
+    };
+
+    struct Charge
+    {
+        curl::Priority priority;
+        size_t bytes;
+    };
+
+    struct Latencies
+    {
+        std::vector<long> samples; // ring buffer
+        size_t next;
+    };
+
+    /**
+     * Per queue ID data. The request is only valid while it's linked into one of the queues, the request and handler are
+     * assigned to so that their buffers are reused.
+     */
+    struct Slot
+    {
+        BasicThreadSharedData::Request request;
+        curl::CompletionHandler handler;
+        bool hasHandler;
+        int rateLimit;         // index into `m_rateLimits` or -1, valid if `rateLimitGen` equals `m_rateLimitGen`
+        unsigned rateLimitGen;
+
+        Slot()
+            : request(), handler(), hasHandler(false), rateLimit(-1), rateLimitGen(0)
+        {}
+    };
+
+    using Queue = curl::RequestQueue<BasicThreadSharedData::Slot, Policy>;
 
-    ThreadSharedData::Response m_response;
+    /**
+     * Submission shard, see `curl::setSharding()`. The producers of a shard are serialised by its lock, so each ring has
+     * one producer at a time. The worker is the consumer. The slots of the cached and the submitted IDs are owned by the
+     * shard until the worker merges them.
+     */
+    struct Shard
+    {
+        curl::SpinLock lock;
+        std::unique_ptr<curl::SpscRing<curl::QueueId::id_type>> rings[3]; // submitted IDs, indexed by priority
+        std::vector<curl::QueueId::id_type> ids;                          // acquired, but not handed out yet
+
+        explicit Shard(size_t ringCapacity);
+    };
 
+    struct Batcher
+    {
+        curl::BatchConfig config;
+        std::vector<BasicThreadSharedData::Request> items; // not yet sent
+        size_t bytes;                                 // of the item bodies
+        int64_t due_ms;
+        uint64_t timerSeq; // the timer refers to the first item
+    };
+
+    BasicThreadSharedData::Queue m_slots; // indexed by queue ID, the priority is the level
+    std::map<curl::QueueId::id_type, BasicThreadSharedData::Delayed> m_qDelayed;
+    std::map<curl::QueueId::id_type, BasicThreadSharedData::Scheduled> m_scheduled;
+    curl::TimerWheel<BasicThreadSharedData::TimerRef> m_timer; // 1 tick = 1ms, see `curl::util::steadyTime_ms()`
+    uint64_t m_timerSeq;
+    std::vector<BasicThreadSharedData::TokenBucket> m_rateLimits;
+    unsigned m_rateLimitGen; // changed with every change of `m_rateLimits`
+    long m_throttleWait_ms; // time until the next token of a bucket which currently blocks a request, -1 if none
+    std::map<std::string, BasicThreadSharedData::Breaker> m_breakers; // key is the host
+    curl::CircuitBreakerConfig m_breakerConfig;
+    curl::ByteBudget m_budget;
+    std::vector<BasicThreadSharedData::Charge> m_charges; // indexed by queue ID, empty until a budget has been set
+    size_t m_budgetUsed[3];                          // indexed by priority
+    std::condition_variable m_budgetCv;              // notified when charges are released
+    curl::ShedConfig m_shedConfig;
+    std::deque<curl::QueueId::id_type> m_shed; // shed requests whose `E_SHED` response has not been set yet
+    std::vector<curl::QueueId::id_type> m_cancelled; // cancelled requests which are in flight, their response is discarded
+    curl::QueueId m_inFlight;
+    std::map<curl::QueueId::id_type, curl::CompletionQueuePtr> m_routes; // until the completion is drained
+    curl::CompletionQueuePtr m_defaultQueue;                             // of `curl::Delivery::completionFd`, created on demand
+    int64_t m_drainDeadline_ms;                                          // see `curl::util::steadyTime_ms()`, -1 if not draining
+    std::vector<std::string> m_warmUp;                                   // origins which have not been taken by the worker yet
+    std::condition_variable m_workCv;                                    // wakes the worker, see `waitForWork()`
+    bool m_wake;
+    double m_hedgeRatio; // hedge tokens earned per transfer
+    double m_hedgeBurst;
+    double m_hedgeTokens;
+    std::map<std::string, BasicThreadSharedData::Latencies> m_latencies; // of the successful transfers, key is the host
+    std::map<std::string, BasicThreadSharedData::Batcher> m_batchers;    // key is the URL
+    std::map<curl::QueueId::id_type, std::vector<curl::QueueId::id_type>> m_batches; // the other requests of a sent batch, key is the ID of the batch
+    curl::SpoolConfig m_spoolConfig;
+    std::unique_ptr<curl::Spool> m_spool; // `nullptr` until a spool has been opened
+    std::vector<uint64_t> m_spoolSeq;     // sequence numbers of the spool records indexed by queue ID, 0 if not spooled
+    curl::Stats m_stats; // only the counters are used
+
+    BasicThreadSharedData::Response m_response;
+
+    // read without the lock, written with it held
+    std::atomic<curl::QueueId::id_type> m_responseId; // `m_response.queueId()`
+    std::atomic<size_t> m_qDelayedSize;
+    std::atomic<size_t> m_scheduledCount;
+
+    std::vector<std::unique_ptr<BasicThreadSharedData::Shard>> m_shards; // not changed anymore once `m_sharded` is set
+    curl::ShardConfig m_shardConfig;                                // of the shards
+    size_t m_shardIds;                                              // number of IDs a shard keeps at most
+    std::atomic<bool> m_sharded;                                    // the shards exist, they are kept when disabled
+    bool m_shardingEnabled;
+    std::atomic<unsigned> m_shardLevels; // bit per priority, set if its requests are submitted through the shards
+    std::atomic<uint64_t> m_shardPending; // bit `i % 64` is set if shard `i` may have requests to merge
+    std::atomic<bool> m_workerWaiting;   // the worker is or is about to be in `waitForWork()`
+
+    curl::QueueId m_queueRequest(const curl::Request& req, const curl::Priority& priority, uint64_t spoolSeq = 0);
+    bool m_shedAdmit(const curl::Priority& priority);
+    bool m_budgetAdmit(const curl::Priority& priority, size_t bytes) const;
+    bool m_budgetFits(const curl::Priority& priority, size_t bytes) const;
+    void m_setCharge(curl::QueueId::id_type id, const curl::Priority& priority, size_t bytes);
+    void m_chargeResponse(curl::QueueId::id_type id, size_t bytes);
+    void m_push(const BasicThreadSharedData::Request& req);
+    int m_matchRateLimit(const std::string& url) const;
+    void m_resolveRateLimit(BasicThreadSharedData::Slot& slot);
+    BasicThreadSharedData::TokenBucket* m_findRateLimit(BasicThreadSharedData::Slot& slot);
+    void m_advanceTimers();
+    void m_publishCounts();
+    uint64_t m_insertTimer(curl::QueueId::id_type id, int64_t due_ms);
     void m_rmQueueId(curl::QueueId::id_type id);
+    void m_release(curl::QueueId::id_type id);
+    const curl::CompletionQueuePtr& m_getDefaultQueue();
     curl::QueueId m_getNewQueueId();
+    void m_wakeWorker();
+    void m_unqueue(curl::QueueId::id_type id, const curl::Priority& priority);
+    BasicThreadSharedData::Batcher* m_findBatcher(const BasicThreadSharedData::Request& req);
+    void m_addToBatch(BasicThreadSharedData::Batcher& batcher, const BasicThreadSharedData::Request& req);
+    void m_flushBatch(BasicThreadSharedData::Batcher& batcher);
+    void m_spoolAppend(const BasicThreadSharedData::Request& req, uint64_t spoolSeq);
+    curl::QueueId m_submit(const curl::Request& req, const curl::Priority& priority);
+    void m_drainShards();
+    size_t m_reclaimShardIds();
+    void m_suspendShards();
+    void m_updateShardLevels();
+    size_t m_shardedSize(const curl::Priority& priority) const;
 
 
 public:
     // thread intern
 
     // clang-format off
-    ThreadSharedData::Request popRequest();
-    void setResponse(const curl::Response& res, const QueueId& queueId) { lock_guard lg(m_mtx); m_response = Response(res, queueId); }
-    QueueId getResponseQueueId() const { lock_guard lg(m_mtx); return m_response.queueId(); }
+    BasicThreadSharedData::Request popRequest();
+    bool popRequest(BasicThreadSharedData::Request& req);
+    QueueId popShed();
+    bool delayRequest(const BasicThreadSharedData::Request& req, long delay_ms);
+    long timeToNextTimer();
+    bool setResponse(const curl::Response& res, const QueueId& queueId);
+    bool circuitAllow(const std::string& host);
+    void circuitReport(const std::string& host, bool failed);
+    QueueId getResponseQueueId() const { return m_responseId.load(std::memory_order_acquire); }
+    void releaseCompletions(const std::vector<curl::Completion>& completions);
+    int64_t drainDeadline() const { lock_guard lg(m_mtx); return m_drainDeadline_ms; }
+    bool deliversToSlot(const QueueId& queueId) const;
+    std::vector<BasicThreadSharedData::Request> takeRemaining();
+    std::vector<std::string> takeWarmUp();
+    void waitForWork(int timeout_us);
+    long hedgeDelay(const std::string& host, const curl::HedgePolicy& policy) const;
+    bool hedgeAllow();
+    void hedgeWon() { lock_guard lg(m_mtx); ++m_stats.hedgeWins; }
+    void reportLatency(const std::string& host, long latency_ms);
+    std::vector<curl::QueueId> takeBatchMembers(const QueueId& queueId);
+    void flushBatches();
     // clang-format on
 };
 
+/**
+ * @brief Shared data with the default queue policy, the type of `curl::sharedData`.
+ */
+using ThreadSharedData = BasicThreadSharedData<curl::ThreadQueuePolicy>;
+
+extern template class BasicThreadSharedData<curl::ThreadQueuePolicy>;
+extern template class BasicThreadSharedData<curl::DebugQueuePolicy>;
+
 
 
 extern ThreadSharedData sharedData;
 
 void thread();
 
+
+
+/**
+ * @brief Receives the responses of the requests which have been queued with it.
+ *
+ * The worker pushes the completed responses directly into the queue, so consumers with their own queue don't share
+ * the response slot or compete for it. A consumer drains its queue in batches, either blocking (`wait()`), non blocking
+ * (`drain()`) or driven by an event loop (`fd()`). The queue IDs stay reserved until their completion is drained.
+ *
+ * @code
+ * const curl::CompletionQueuePtr queue = curl::makeCompletionQueue();
+ * curl::queueRequest(req, curl::Priority::normal, queue);
+ * const std::vector<curl::Completion> completions = queue->wait(std::chrono::seconds(1));
+ * @endcode
+ */
+class CompletionQueue
+{
+public:
+    template <class Policy = curl::ThreadQueuePolicy>
+    explicit CompletionQueue(BasicThreadSharedData<Policy>& sd = sharedData)
+        : CompletionQueue([&sd](const std::vector<curl::Completion>& completions) { sd.releaseCompletions(completions); })
+    {}
+
+    virtual ~CompletionQueue();
+
+    CompletionQueue(const CompletionQueue&) = delete;
+    CompletionQueue& operator=(const CompletionQueue&) = delete;
+
+    bool empty() const;
+    size_t size() const;
+
+    /**
+     * @brief Returns the completions which are ready, does not block.
+     */
+    std::vector<curl::Completion> drain();
+
+    /**
+     * @brief Waits up to `timeout` until there is at least one completion, and returns the ready ones.
+     */
+    std::vector<curl::Completion> wait(const std::chrono::milliseconds& timeout);
+
+    /**
+     * @brief File descriptor which is readable while the queue is not empty.
+     *
+     * An `eventfd` on Linux, the read end of a pipe on other POSIX systems. It's created on the first call and owned by
+     * the queue, it must not be read or closed by the caller. It's only signalled when the queue changes from empty to
+     * not empty, so there are no wakeups per response.
+     *
+     * @return The file descriptor, or -1 if it could not be created or on Windows
+     */
+    int fd();
+
+private:
+    std::function<void(const std::vector<curl::Completion>&)> m_release; // gives the IDs back to the shared data
+    mutable std::mutex m_mtx;
+    std::condition_variable m_cv;
+    std::vector<curl::Completion> m_items;
+    int m_notifyFd[2]; // read and write end, the same for an eventfd, -1 if not created
+
+    explicit CompletionQueue(const std::function<void(const std::vector<curl::Completion>&)>& release);
+
+    std::vector<curl::Completion> m_take();
+    void m_notify();
+
+public:
+    // thread intern
+
+    void push(const curl::Completion& completion);
+    bool remove(const curl::QueueId& queueId);
+};
+
+static inline curl::CompletionQueuePtr makeCompletionQueue() { return std::make_shared<curl::CompletionQueue>(); }
+
 static inline bool booted() { return sharedData.booted(); }
 static inline void shutdown() { sharedData.shutdown(); }
 
+/**
+ * @brief Opens keep-alive connections to the origins in the background.
+ *
+ * The host names are resolved and a connection is established (including the TLS handshake) with a `HEAD` request to
+ * each origin, e.g. `https://example.com`. The DNS entries, connections and TLS sessions are kept in a cache which is
+ * shared by all requests of the curl thread, so the first requests to these origins don't pay for the setup. Queued
+ * requests are performed while the connections are being established. Can be called before the thread is started.
+ */
+static inline void warmUp(const std::vector<std::string>& origins) { sharedData.warmUp(origins); }
+
+/**
+ * @brief Shuts down the curl thread after draining the queues.
+ *
+ * The queued requests are performed concurrently until the queues are empty or `drainTimeout` has passed. Retries
+ * are only delayed if they are due before the deadline. The requests which are still queued, delayed or in flight by
+ * then complete with `curl::Response::E_SHUTDOWN`, scheduled requests are cancelled.
+ *
+ * Responses which have to be popped are set one at a time, the consumers have to keep popping while the thread drains.
+ * After the deadline they are set for up to one more second, the ones which are still waiting for the slot by then are
+ * discarded and their IDs released. Use completion handlers or queues to receive all of them.
+ */
+static inline void shutdown(const std::chrono::milliseconds& drainTimeout) { sharedData.shutdown(drainTimeout); }
+
 static inline curl::QueueId queueRequest(const curl::Request& req, const curl::Priority& priority) { return sharedData.queueRequest(req, priority); }
+
+/**
+ * @brief Queues the request, waiting up to `timeout` for the byte budget.
+ *
+ * Returns `curl::QueueId::OVER_BUDGET` immediately if the request is larger than the budget, or after the timeout if
+ * there was not enough budget released in the meantime. Without a byte budget it's the same as
+ * `curl::queueRequest(const curl::Request&, const curl::Priority&)`.
+ */
+static inline curl::QueueId queueRequest(const curl::Request& req, const curl::Priority& priority, const std::chrono::milliseconds& timeout)
+{
+    return sharedData.queueRequest(req, priority, timeout);
+}
+
+/**
+ * @brief Queues the request, `handler` is called with the response instead of setting it to be popped.
+ *
+ * The handler is called on the curl thread and should return quickly, the next request is not performed before it
+ * returns. Exceptions thrown by the handler are ignored. The queue ID is released after the handler returned.
+ *
+ * @return The queue ID, which is also the handle for `curl::cancelRequest()`
+ */
+static inline curl::QueueId queueRequest(const curl::Request& req, const curl::Priority& priority, const curl::CompletionHandler& handler)
+{
+    return sharedData.queueRequest(req, priority, handler);
+}
+
+/**
+ * @brief Cancels a queued request.
+ *
+ * A request which is in flight is not aborted, but its response is discarded. A response which is ready and not yet
+ * popped is discarded too. The handler of the request, if any, is not called. Use `curl::cancelSchedule()` for
+ * scheduled requests.
+ *
+ * @return `false` if there is no such request (anymore), or if its handler is being called
+ */
+static inline bool cancelRequest(const curl::QueueId& queueId) { return sharedData.cancelRequest(queueId); }
+
+/**
+ * @brief Checks if the response of the request is ready to be popped.
+ *
+ * Doesn't lock, so polling it doesn't contend with queueing and completing requests.
+ */
 static inline bool responseReady(const curl::QueueId& queueId) { return sharedData.responseReady(queueId); }
 static inline curl::Response popResponse() { return sharedData.popResponse(); }
 
+/**
+ * @brief Pops the ready response into `res`.
+ *
+ * The buffers of `res` are swapped with the ones of the internal response, so that reusing the same `res` for every
+ * response doesn't allocate once the buffers have grown to the size needed.
+ */
+static inline void popResponse(curl::Response& res) { sharedData.popResponse(res); }
+
+/**
+ * @brief Queues the request, its response is delivered as specified.
+ *
+ * With `curl::Delivery::completionFd` the response is not set to be popped, it's pushed to a completion queue owned by
+ * the library instead, see `curl::drainCompletions()`. The worker doesn't wait for them to be drained.
+ */
+static inline curl::QueueId queueRequest(const curl::Request& req, const curl::Priority& priority, const curl::Delivery& delivery)
+{
+    return sharedData.queueRequest(req, priority, delivery);
+}
+
+/**
+ * @brief Queues the request, its response is pushed to `queue`.
+ *
+ * @return The queue ID, or `curl::QueueId::FAILED` if `queue` is null
+ */
+static inline curl::QueueId queueRequest(const curl::Request& req, const curl::Priority& priority, const curl::CompletionQueuePtr& queue)
+{
+    return sharedData.queueRequest(req, priority, queue);
+}
+
+/**
+ * @brief File descriptor of the completion queue of `curl::Delivery::completionFd`, see `curl::CompletionQueue::fd()`.
+ *
+ * Register it with `epoll`, `poll`, `io_uring` etc. and call `curl::drainCompletions()` once it's readable.
+ */
+static inline int completionFd() { return sharedData.completionFd(); }
+
+/**
+ * @brief Returns the responses of the requests queued with `curl::Delivery::completionFd` which have completed.
+ *
+ * Does not block. Resets the completion fd, the queue IDs of the returned completions are released.
+ */
+static inline std::vector<curl::Completion> drainCompletions() { return sharedData.drainCompletions(); }
+
+/**
+ * @brief Queues the request at the specified time.
+ *
+ * The returned queue ID is reserved immediately, the response is obtained as with `curl::queueRequest()`.
+ *
+ * @return The queue ID, which is also the handle for `curl::cancelSchedule()`
+ */
+static inline curl::QueueId scheduleRequest(const curl::Request& req, const curl::Priority& priority, const std::chrono::steady_clock::time_point& at)
+{
+    return sharedData.scheduleRequest(req, priority, at);
+}
+
+/**
+ * @brief Queues the request repeatedly.
+ *
+ * The first firing is now (plus jitter), then every `interval` plus a random jitter in the range [0, `jitter`]. The
+ * jitter does not accumulate. All responses carry the returned queue ID, which stays reserved until the schedule is
+ * cancelled. A firing is skipped if the response of the previous one has not been popped yet.
+ *
+ * @return The queue ID, which is also the handle for `curl::cancelSchedule()`
+ */
+static inline curl::QueueId scheduleRecurring(const curl::Request& req, const curl::Priority& priority, const std::chrono::milliseconds& interval,
+                                              const std::chrono::milliseconds& jitter = std::chrono::milliseconds(0))
+{
+    return sharedData.scheduleRecurring(req, priority, interval, jitter);
+}
+
+/**
+ * @brief Cancels a scheduled or recurring request.
+ *
+ * An already queued firing is not cancelled, its response is delivered and releases the queue ID when popped.
+ *
+ * @return `false` if there is no such schedule (anymore)
+ */
+static inline bool cancelSchedule(const curl::QueueId& queueId) { return sharedData.cancelSchedule(queueId); }
+
+/**
+ * @brief Limits the rate at which requests are dispatched to a host or URL prefix.
+ *
+ * Token bucket which holds up to `burst` tokens and is refilled with `rate` tokens per second, every dispatched
+ * request takes one token. Requests which are throttled stay in their queue, requests to other hosts are dispatched in
+ * the meantime. If several limits match, the most specific one is applied: a URL prefix wins over the host, and the
+ * longest of several matching prefixes wins.
+ *
+ * Setting the limit of an existing host or prefix updates it.
+ *
+ * @param hostOrPrefix Host name (e.g. `api.agify.io`) or URL prefix including the scheme (e.g. `https://api.agify.io/v2/`)
+ * @param rate Requests per second
+ * @param burst Maximum number of requests which can be dispatched at once, at least 1
+ */
+static inline void setRateLimit(const std::string& hostOrPrefix, double rate, double burst = 1)
+{
+    sharedData.setRateLimit(hostOrPrefix, rate, burst);
+}
+
+static inline bool removeRateLimit(const std::string& hostOrPrefix) { return sharedData.removeRateLimit(hostOrPrefix); }
+
+/**
+ * @brief Configures the per host circuit breakers, see `curl::CircuitBreakerConfig`.
+ *
+ * Disabled by default. The state of the breakers is kept when the configuration changes.
+ */
+static inline void setCircuitBreaker(const curl::CircuitBreakerConfig& config) { sharedData.setCircuitBreaker(config); }
+
+/**
+ * @brief Sets the byte budget, see `curl::ByteBudget`.
+ *
+ * Unlimited by default. Requests which are queued before a budget is set for the first time are not charged.
+ */
+static inline void setByteBudget(const curl::ByteBudget& budget) { sharedData.setByteBudget(budget); }
+
+/**
+ * @brief Configures the load shedding, see `curl::ShedConfig`.
+ *
+ * Disabled by default.
+ */
+static inline void setLoadShedding(const curl::ShedConfig& config) { sharedData.setLoadShedding(config); }
+
+/**
+ * @brief Limits the duplicates issued by hedged requests, see `curl::HedgePolicy`.
+ *
+ * Token bucket which holds up to `burst` tokens, every performed transfer earns `ratio` tokens and every duplicate
+ * takes one. So in the long run at most `ratio` of the transfers are duplicated. Requests whose hedge delay has passed
+ * while the bucket is empty are not hedged. Default is a ratio of 0.1 and a burst of 10.
+ */
+static inline void setHedgeLimit(double ratio, double burst) { sharedData.setHedgeLimit(ratio, burst); }
+
+/**
+ * @brief Batches the small `POST` requests to `url`, see `curl::BatchConfig`.
+ *
+ * Every request keeps its own queue ID, which is completed with the response of the batch. The batch is sent with the
+ * header, user agent, timeouts and policies of its first request, and carries the queue ID of that request. Requests
+ * with an upload source or download file are not batched. Cancelling a request which has been sent with a batch only
+ * discards its response.
+ *
+ * Setting the configuration of an existing endpoint updates it.
+ *
+ * @param url The whole URL, as returned by `curl::Request::url()`
+ */
+static inline void setBatching(const std::string& url, const curl::BatchConfig& config) { sharedData.setBatching(url, config); }
+
+/**
+ * @brief Stops batching the requests to `url`, the collected ones are sent.
+ */
+static inline bool removeBatching(const std::string& url) { return sharedData.removeBatching(url); }
+
+/**
+ * @brief Opens the request spool and replays the requests which have not been completed in a previous run.
+ *
+ * The requests of the priorities selected by `config` are appended to the spool file when they are queued, and are
+ * removed once they are completed. Requests which fail with `curl::Response::E_SHUTDOWN` stay in the spool, as do
+ * the ones which are still queued when the process exits. See `curl::Spool` for the file format and the durability.
+ *
+ * The replayed requests are queued immediately, their responses are passed to the replay handler of `config`. Header,
+ * body, timeouts and response size limit are persisted, retry and hedge policies and handlers are not. Requests with
+ * an upload source or download file and scheduled requests are not spooled, and neither are requests which don't fit
+ * into the ring anymore (see `curl::Stats::spoolFull`). A replayed request which can't be queued stays in the spool
+ * until it's opened again.
+ *
+ * Should be called once, before any request is queued. Not available on Windows.
+ *
+ * @return Number of replayed requests, -1 if the spool could not be opened
+ */
+static inline int openSpool(const std::string& filename, const curl::SpoolConfig& config) { return sharedData.openSpool(filename, config); }
+
+/**
+ * @brief Lets `curl::queueRequest(const curl::Request&, const curl::Priority&)` bypass the shared queue lock.
+ *
+ * Each shard has a single producer ring per priority. The producer threads are assigned to the shards round robin,
+ * threads which share a shard take turns. A request is written into the slot of a queue ID the shard has taken in
+ * advance, and the ID is pushed into the ring. The worker merges the rings into the priority queues before it pops a
+ * request, so the priorities are kept and the requests of one producer stay in order.
+ *
+ * Only the ID refill takes the queue lock. A shard takes up to 8 IDs at once, and the shards keep at most a quarter of
+ * the IDs. The cached IDs are given back when the IDs run out for the other paths, at shutdown, and when sharding is
+ * disabled.
+ *
+ * Requests which are subject to the byte budget, load shedding, batching or the spool, and the requests queued with
+ * a handler, a completion queue or a timeout take the locked path. So does a request whose ring is full, after the
+ * rings have been merged.
+ *
+ * The byte budget, load shedding, batching and the spool can also be enabled once sharding is enabled. The shards are
+ * closed and merged before the setting changes, so no request which is queued afterwards bypasses it.
+ *
+ * Passing a configuration with 0 shards disables sharding. The shards are kept, sharding can only be enabled again with
+ * the configuration of the first call.
+ *
+ * @return `false` if sharding is already enabled or the configuration is invalid
+ */
+static inline bool setSharding(const curl::ShardConfig& config) { return sharedData.setSharding(config); }
+
+static inline curl::Stats getStats() { return sharedData.getStats(); }
+
 
 
 //! \name Utility
@@ -153,6 +820,7 @@ static inline curl::Response popResponse() { return sharedData.popResponse(); }
 
 std::string toString(const Method& method);
 std::string toString(const Priority& priority);
+std::string toString(const CircuitState& state);
 
 /**
  * @brief Get a random integer in range [min, max].
@@ -0,0 +1,242 @@
+/*
+author          Oliver Blaser
+date            18.10.2026
+copyright       MIT - Copyright (c) 2026 Oliver Blaser
+*/
+
+#ifndef IG_CURLTHREAD_REQUESTQUEUE_H
+#define IG_CURLTHREAD_REQUESTQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <thread>
+
+#include "../curl-thread/slottable.h"
+
+
+namespace curl {
+
+/**
+ * @brief Lock which doesn't lock, for queues which are guarded by the owner or used by one thread only.
+ */
+class NullLock
+{
+public:
+    NullLock() {}
+    virtual ~NullLock() {}
+
+    void lock() {}
+    bool try_lock() { return true; }
+    void unlock() {}
+};
+
+/**
+ * @brief Test and set spin lock, yields while spinning.
+ *
+ * Only suitable for short critical sections.
+ */
+class SpinLock
+{
+public:
+    SpinLock() { m_flag.clear(); }
+    virtual ~SpinLock() {}
+
+    void lock()
+    {
+        while (m_flag.test_and_set(std::memory_order_acquire)) { std::this_thread::yield(); }
+    }
+
+    bool try_lock() { return !m_flag.test_and_set(std::memory_order_acquire); }
+    void unlock() { m_flag.clear(std::memory_order_release); }
+
+private:
+    std::atomic_flag m_flag;
+
+    SpinLock(const SpinLock& other) = delete;
+    SpinLock& operator=(const SpinLock& other) = delete;
+};
+
+/**
+ * @brief Default policy of `curl::RequestQueue`.
+ *
+ * A policy derives from this and hides the members it changes. All members are resolved at compile time.
+ */
+struct QueuePolicy
+{
+    /**
+     * @brief Number of IDs, they are in range [1, `capacity`].
+     */
+    static constexpr int capacity = 1024;
+
+    static constexpr int priorityLevels = 3;
+
+    /**
+     * @brief Signed integer type of the IDs and of the links between the slots.
+     */
+    using index_type = int;
+
+    /**
+     * @brief Type of the lock of the queue, has to be _Lockable_. `curl::NullLock` if the owner guards the queue.
+     */
+    using mutex_type = curl::NullLock;
+
+    /**
+     * @brief If set, `debugHook()` is called after every acquire and release.
+     */
+    static constexpr bool debugHooks = false;
+
+    /**
+     * @param event "acquire" or "release"
+     * @param acquired The acquired IDs, separated by spaces
+     */
+    static void debugHook(const char* event, int id, const std::string& acquired)
+    {
+        (void)event;
+        (void)id;
+        (void)acquired;
+    }
+};
+
+/**
+ * @brief Preallocated request queue with a FIFO per priority level, shaped by a compile-time policy.
+ *
+ * Every ID owns a slot, see `curl::SlotTable`. An acquired slot can be linked into the list of one level. The queue
+ * itself is _Lockable_ with the lock type of the policy, so that it can be used with `std::lock_guard`. The other
+ * members don't lock.
+ *
+ * @tparam T Value type of the slots, has to be default constructible
+ * @tparam Policy See `curl::QueuePolicy`
+ */
+template <typename T, class Policy = curl::QueuePolicy> class RequestQueue
+{
+public:
+    using index_type = typename Policy::index_type;
+    using mutex_type = typename Policy::mutex_type;
+    using policy_type = Policy;
+
+    static constexpr int capacity = Policy::capacity;
+    static constexpr int priorityLevels = Policy::priorityLevels;
+    static constexpr index_type none = curl::SlotTable<T, index_type>::none;
+
+    static_assert((capacity > 0) && ((long long)capacity <= (long long)std::numeric_limits<index_type>::max()), "the IDs don't fit into index_type");
+    static_assert(std::numeric_limits<index_type>::is_signed, "index_type has to be signed");
+    static_assert(priorityLevels > 0, "at least one priority level is needed");
+
+public:
+    RequestQueue()
+        : m_slots(1, capacity), m_levels(), m_sizes(), m_mtx()
+    {
+        for (int i = 0; i < priorityLevels; ++i) { m_sizes[i].store(0, std::memory_order_relaxed); }
+    }
+
+    virtual ~RequestQueue() {}
+
+    void lock() { m_mtx.lock(); }
+    bool try_lock() { return m_mtx.try_lock(); }
+    void unlock() { m_mtx.unlock(); }
+
+    T& operator[](index_type id) { return m_slots[id]; }
+    const T& operator[](index_type id) const { return m_slots[id]; }
+
+    /**
+     * @brief Acquires the lowest free ID.
+     *
+     * @return The ID, or `none` if all are in use
+     */
+    index_type acquire()
+    {
+        const index_type id = m_slots.acquire();
+        m_debugHook("acquire", id);
+        return id;
+    }
+
+    /**
+     * @brief Releases the ID, its slot has to be unlinked. Does nothing if it's not acquired.
+     */
+    void release(index_type id)
+    {
+        if (!m_slots.acquired(id)) { return; }
+
+        m_slots.release(id);
+        m_debugHook("release", id);
+    }
+
+    bool acquired(long id) const { return m_slots.acquired(id); }
+    size_t acquiredCount() const { return m_slots.acquiredCount(); }
+
+    /**
+     * @brief Appends the slot to the list of `level`, it must not be linked.
+     */
+    void push(int level, index_type id)
+    {
+        m_slots.pushBack(m_levels[level], id);
+        m_sizes[level].store(m_levels[level].size(), std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Unlinks the slot, it has to be linked into the list of `level`.
+     */
+    void remove(int level, index_type id)
+    {
+        m_slots.remove(m_levels[level], id);
+        m_sizes[level].store(m_levels[level].size(), std::memory_order_relaxed);
+    }
+
+    bool linked(index_type id) const { return m_slots.linked(id); }
+    index_type front(int level) const { return m_levels[level].front(); }
+    index_type back(int level) const { return m_levels[level].back(); }
+    index_type next(index_type id) const { return m_slots.next(id); }
+    size_t size(int level) const { return m_levels[level].size(); }
+    bool empty(int level) const { return m_levels[level].empty(); }
+
+    /**
+     * @brief Same as `size(int)`, but can be called without holding the lock. Doesn't wait, the value may be outdated.
+     */
+    size_t loadSize(int level) const { return m_sizes[level].load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Number of linked slots of all levels.
+     */
+    size_t size() const
+    {
+        size_t n = 0;
+        for (int i = 0; i < priorityLevels; ++i) { n += m_levels[i].size(); }
+        return n;
+    }
+
+private:
+    curl::SlotTable<T, index_type> m_slots;
+    typename curl::SlotTable<T, index_type>::List m_levels[priorityLevels];
+    std::atomic<size_t> m_sizes[priorityLevels]; // published after every change, see `loadSize()`
+    mutex_type m_mtx;
+
+    void m_debugHook(const char* event, index_type id) const
+    {
+        // dead code if the hooks are disabled
+        if (Policy::debugHooks)
+        {
+            std::string acquired;
+            for (int i = 1; i <= capacity; ++i)
+            {
+                if (m_slots.acquired(i)) { acquired += (acquired.empty() ? "" : " ") + std::to_string(i); }
+            }
+
+            Policy::debugHook(event, id, acquired);
+        }
+    }
+
+    RequestQueue(const RequestQueue& other) = delete;
+    RequestQueue& operator=(const RequestQueue& other) = delete;
+};
+
+template <typename T, class Policy> constexpr int RequestQueue<T, Policy>::capacity;
+template <typename T, class Policy> constexpr int RequestQueue<T, Policy>::priorityLevels;
+template <typename T, class Policy> constexpr typename RequestQueue<T, Policy>::index_type RequestQueue<T, Policy>::none;
+
+} // namespace curl
+
+
+#endif // IG_CURLTHREAD_REQUESTQUEUE_H
@@ -0,0 +1,198 @@
+/*
+author          Oliver Blaser
+date            18.10.2026
+copyright       MIT - Copyright (c) 2026 Oliver Blaser
+*/
+
+#ifndef IG_CURLTHREAD_SLOTTABLE_H
+#define IG_CURLTHREAD_SLOTTABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+namespace curl {
+
+/**
+ * @brief Table of preallocated slots, indexed directly by the slot index.
+ *
+ * All slots are constructed up front and their values are reused. Values which keep their buffers when assigned to
+ * (`std::string`, `std::vector`) don't allocate anymore, once the buffers have grown to the size needed.
+ *
+ * Indexes in the range [`first`, `last`] are acquired lowest first, the free ones are kept in a bitmap. An acquired
+ * slot can be linked into one list at a time. Lists are intrusive doubly linked FIFOs, so linking and unlinking are
+ * O(1) and don't allocate.
+ *
+ * Not thread safe.
+ *
+ * @tparam T Value type, has to be default constructible
+ * @tparam Index Signed integer type of the indexes and links
+ */
+template <typename T, typename Index = int> class SlotTable
+{
+public:
+    using index_type = Index;
+
+    static constexpr index_type none = -1;
+
+    class List
+    {
+    public:
+        List()
+            : m_head(none), m_tail(none), m_size(0)
+        {}
+
+        virtual ~List() {}
+
+        index_type front() const { return m_head; }
+        index_type back() const { return m_tail; }
+        size_t size() const { return m_size; }
+        bool empty() const { return (m_size == 0); }
+
+    private:
+        friend class SlotTable;
+
+        index_type m_head;
+        index_type m_tail;
+        size_t m_size;
+    };
+
+public:
+    SlotTable() = delete;
+
+    SlotTable(index_type first, index_type last)
+        : m_slots((size_t)last + 1), m_free(((size_t)last + 64) / 64, 0), m_first(first), m_last(last), m_lowWord(0), m_acquired(0)
+    {
+        for (long i = first; i <= (long)last; ++i) { m_free[(size_t)i / 64] |= (uint64_t(1) << (i % 64)); }
+        m_lowWord = (size_t)first / 64;
+    }
+
+    virtual ~SlotTable() {}
+
+    T& operator[](index_type i) { return m_slots[(size_t)i].value; }
+    const T& operator[](index_type i) const { return m_slots[(size_t)i].value; }
+
+    /**
+     * @brief Acquires the lowest free index.
+     *
+     * @return The index, or `none` if all are in use
+     */
+    index_type acquire()
+    {
+        for (size_t w = m_lowWord; w < m_free.size(); ++w)
+        {
+            if (m_free[w] != 0)
+            {
+                const index_type i = (index_type)((w * 64) + m_ctz(m_free[w]));
+                m_free[w] &= ~(uint64_t(1) << (i % 64));
+                m_lowWord = w;
+                ++m_acquired;
+                return i;
+            }
+        }
+
+        m_lowWord = m_free.size();
+        return none;
+    }
+
+    /**
+     * @brief Releases the index, it has to be unlinked. Does nothing if it's not acquired.
+     */
+    void release(index_type i)
+    {
+        if (!acquired(i)) { return; }
+
+        m_free[(size_t)i / 64] |= (uint64_t(1) << (i % 64));
+        if (((size_t)i / 64) < m_lowWord) { m_lowWord = (size_t)i / 64; }
+        --m_acquired;
+    }
+
+    bool acquired(long i) const { return ((i >= m_first) && (i <= m_last) && ((m_free[(size_t)i / 64] & (uint64_t(1) << (i % 64))) == 0)); }
+    size_t acquiredCount() const { return m_acquired; }
+
+    /**
+     * @brief Appends the slot to the list, it must not be linked.
+     */
+    void pushBack(List& list, index_type i)
+    {
+        Slot& s = m_slots[(size_t)i];
+        s.prev = list.m_tail;
+        s.next = none;
+        s.linked = true;
+
+        if (list.m_tail != none) { m_slots[(size_t)list.m_tail].next = i; }
+        else { list.m_head = i; }
+
+        list.m_tail = i;
+        ++list.m_size;
+    }
+
+    /**
+     * @brief Unlinks the slot, it has to be linked into `list`.
+     */
+    void remove(List& list, index_type i)
+    {
+        Slot& s = m_slots[(size_t)i];
+
+        if (s.prev != none) { m_slots[(size_t)s.prev].next = s.next; }
+        else { list.m_head = s.next; }
+
+        if (s.next != none) { m_slots[(size_t)s.next].prev = s.prev; }
+        else { list.m_tail = s.prev; }
+
+        s.prev = none;
+        s.next = none;
+        s.linked = false;
+        --list.m_size;
+    }
+
+    bool linked(index_type i) const { return m_slots[(size_t)i].linked; }
+
+    /**
+     * @brief The slot after `i` in its list, or `none`.
+     */
+    index_type next(index_type i) const { return m_slots[(size_t)i].next; }
+
+private:
+    struct Slot
+    {
+        Slot()
+            : value(), prev(none), next(none), linked(false)
+        {}
+
+        T value;
+        index_type prev;
+        index_type next;
+        bool linked;
+    };
+
+    std::vector<Slot> m_slots;
+    std::vector<uint64_t> m_free; // bit is set if the index is free
+    index_type m_first;
+    index_type m_last;
+    size_t m_lowWord; // no free index below this word
+    size_t m_acquired;
+
+    static int m_ctz(uint64_t x)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_ctzll(x);
+#else
+        int n = 0;
+        while ((x & 1) == 0)
+        {
+            x >>= 1;
+            ++n;
+        }
+        return n;
+#endif
+    }
+};
+
+template <typename T, typename Index> constexpr typename SlotTable<T, Index>::index_type SlotTable<T, Index>::none;
+
+} // namespace curl
+
+
+#endif // IG_CURLTHREAD_SLOTTABLE_H
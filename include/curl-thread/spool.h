@@ -0,0 +1,129 @@
+/*
+author          Oliver Blaser
+date            18.10.2026
+copyright       MIT - Copyright (c) 2026 Oliver Blaser
+*/
+
+#ifndef IG_CURLTHREAD_SPOOL_H
+#define IG_CURLTHREAD_SPOOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../curl-thread/thread.h"
+#include "../curl-thread/types.h"
+
+
+namespace curl {
+
+/**
+ * @brief Persistent ring of requests in a memory mapped file, see `curl::openSpool()`.
+ *
+ * The file consists of a header and the ring. The header has two slots for the position of the oldest pending record,
+ * which are written alternately and are protected by a checksum, so that a torn header write loses at most the last
+ * trim. A record consists of a record header (magic, payload size, sequence number, CRC-32 and state) and the encoded
+ * request, aligned to 8 bytes. The CRC covers the size, the sequence number and the payload. A record which doesn't
+ * fit at the end of the ring is written at the beginning, the gap is marked by a wrap marker if there is room for it.
+ *
+ * On open the records are read from the oldest pending one on, until a record is invalid or its sequence number
+ * doesn't follow. Completed records are marked as done in place and the head is advanced over them.
+ *
+ * Appending doesn't sync the file. A commit thread syncs the mapping `commitInterval` after the first unsynced append,
+ * so that all appends of an interval share one `msync()` (group commit). The records are safe against a crash of the
+ * process as soon as they are appended, and against a crash of the system once they are committed.
+ *
+ * Only available on POSIX systems.
+ */
+class Spool : public thread::SharedData
+{
+public:
+    struct Record
+    {
+        uint64_t seq;
+        curl::Request request;
+        curl::Priority priority;
+    };
+
+public:
+    Spool();
+    virtual ~Spool();
+
+    /**
+     * @brief Opens the spool file, or creates it if it doesn't exist.
+     *
+     * The capacity of an existing file is kept.
+     *
+     * @param capacity Size of the ring in bytes
+     * @param commitInterval_ms See `curl::SpoolConfig`
+     * @param [out] pending The records which have not been completed, oldest first
+     * @return `false` if the file could not be opened, mapped or locked, or if it's not a spool file
+     */
+    bool open(const std::string& filename, size_t capacity, long commitInterval_ms, std::vector<Spool::Record>* pending);
+
+    /**
+     * @brief Commits and closes the file.
+     */
+    void close();
+
+    /**
+     * @return The sequence number of the record, 0 if it doesn't fit into the ring
+     */
+    uint64_t append(const curl::Request& req, const curl::Priority& priority);
+
+    /**
+     * @brief Marks the record as completed.
+     */
+    void trim(uint64_t seq);
+
+    /**
+     * @brief Number of `msync()` calls done by the commit thread.
+     */
+    uint64_t commits() const;
+
+    /**
+     * @brief Checks if the request can be persisted.
+     *
+     * Streamed uploads, downloads to files and the callbacks of a request can't be persisted.
+     */
+    static bool spoolable(const curl::Request& req) { return (!req.upload() && !req.download()); }
+
+private:
+    struct Live
+    {
+        size_t offset;
+        size_t size;
+        uint64_t seq;
+        bool done;
+    };
+
+    std::string m_filename;
+    int m_fd;
+    char* m_map;
+    size_t m_mapSize;
+    char* m_ring;
+    size_t m_capacity;
+    size_t m_tail;
+    uint64_t m_nextSeq;
+    std::deque<Spool::Live> m_live; // oldest first, the sequence numbers are consecutive
+    size_t m_headWrites;
+    long m_commitInterval_ms;
+    bool m_dirty;
+    bool m_stop;
+    uint64_t m_commits;
+    std::condition_variable m_commitCv;
+    std::thread m_commitThread;
+
+    bool m_recover(std::vector<Spool::Record>* pending);
+    void m_writeHead();
+    void m_commitLoop();
+};
+
+} // namespace curl
+
+
+#endif // IG_CURLTHREAD_SPOOL_H
@@ -0,0 +1,129 @@
+/*
+author          Oliver Blaser
+date            18.10.2026
+copyright       MIT - Copyright (c) 2026 Oliver Blaser
+*/
+
+#ifndef IG_CURLTHREAD_SPSCRING_H
+#define IG_CURLTHREAD_SPSCRING_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+
+namespace curl {
+
+/**
+ * @brief Bounded single producer single consumer ring of preallocated values.
+ *
+ * The producer assigns to the value returned by `back()` and publishes it with `push()`, the consumer reads or swaps
+ * the value returned by `front()` and releases it with `pop()`. The values are reused, so values which keep their
+ * buffers don't allocate once the buffers have grown.
+ *
+ * Head and tail are on separate cache lines, each side keeps a copy of the other side's index and only reloads it when
+ * the ring looks full or empty.
+ *
+ * @tparam T Value type, has to be default constructible
+ */
+template <typename T> class SpscRing
+{
+public:
+    SpscRing() = delete;
+
+    /**
+     * @param capacity Rounded up to a power of two
+     */
+    explicit SpscRing(size_t capacity)
+        : m_slots(m_roundUp(capacity)), m_mask(m_slots.size() - 1), m_head(0), m_cachedTail(0), m_tail(0), m_cachedHead(0)
+    {}
+
+    virtual ~SpscRing() {}
+
+    size_t capacity() const { return m_slots.size(); }
+
+    /**
+     * @brief Producer side, the value to assign to before `push()`.
+     *
+     * @return `nullptr` if the ring is full
+     */
+    T* back()
+    {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+
+        if ((tail - m_cachedHead) >= m_slots.size())
+        {
+            m_cachedHead = m_head.load(std::memory_order_acquire);
+            if ((tail - m_cachedHead) >= m_slots.size()) { return nullptr; }
+        }
+
+        return &m_slots[tail & m_mask];
+    }
+
+    /**
+     * @brief Producer side, publishes the value returned by `back()`.
+     */
+    void push() { m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    /**
+     * @brief Consumer side.
+     *
+     * @return The oldest value, `nullptr` if the ring is empty
+     */
+    T* front()
+    {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+
+        if (head == m_cachedTail)
+        {
+            m_cachedTail = m_tail.load(std::memory_order_acquire);
+            if (head == m_cachedTail) { return nullptr; }
+        }
+
+        return &m_slots[head & m_mask];
+    }
+
+    /**
+     * @brief Consumer side, releases the value returned by `front()`.
+     */
+    void pop() { m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    /**
+     * @brief Can be called from any thread, the value may be outdated.
+     */
+    size_t size() const
+    {
+        // the head never passes the tail, so it's loaded first
+        const size_t head = m_head.load(std::memory_order_acquire);
+        return (m_tail.load(std::memory_order_acquire) - head);
+    }
+
+private:
+    static constexpr size_t cacheLine = 64;
+
+    std::vector<T> m_slots;
+    size_t m_mask;
+
+    char m_pad0[cacheLine];
+    std::atomic<size_t> m_head; // written by the consumer
+    size_t m_cachedTail;        // consumer's copy of the tail
+    char m_pad1[cacheLine];
+    std::atomic<size_t> m_tail; // written by the producer
+    size_t m_cachedHead;        // producer's copy of the head
+    char m_pad2[cacheLine];
+
+    static size_t m_roundUp(size_t n)
+    {
+        size_t r = 1;
+        while (r < n) { r <<= 1; }
+        return r;
+    }
+
+    SpscRing(const SpscRing& other) = delete;
+    SpscRing& operator=(const SpscRing& other) = delete;
+};
+
+} // namespace curl
+
+
+#endif // IG_CURLTHREAD_SPSCRING_H
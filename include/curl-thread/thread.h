@@ -7,6 +7,7 @@ copyright       MIT - Copyright (c) 2025 Oliver Blaser
 #ifndef IG_CURLTHREAD_THREAD_H
 #define IG_CURLTHREAD_THREAD_H
 
+#include <atomic>
 #include <mutex>
 
 
@@ -30,6 +31,9 @@ private:
     SharedData& operator=(SharedData& other) = delete;
 };
 
+/**
+ * @brief Thread control flags, they are atomic so that reading them never blocks.
+ */
 class ThreadCtl : public SharedData
 {
 public:
@@ -41,25 +45,24 @@ public:
 
 
     // clang-format off
-    bool booted() const { lock_guard lg(m_mtxThreadCtl); return m_booted; }
-    void shutdown() { lock_guard lg(m_mtxThreadCtl); m_shutdown = true; }
-    void terminate() { lock_guard lg(m_mtxThreadCtl); m_terminate = true; }
+    bool booted() const { return m_booted.load(std::memory_order_acquire); }
+    void shutdown() { m_shutdown.store(true, std::memory_order_release); }
+    void terminate() { m_terminate.store(true, std::memory_order_release); }
     // clang-format on
 
 
 private:
-    bool m_booted;
-    bool m_shutdown;
-    bool m_terminate;
-    mutable std::mutex m_mtxThreadCtl;
+    std::atomic<bool> m_booted;
+    std::atomic<bool> m_shutdown;
+    std::atomic<bool> m_terminate;
 
 public:
     // thread intern
 
     // clang-format off
-    void setBooted(bool state) { lock_guard lg(m_mtxThreadCtl); m_booted = state; }
-    bool doShutdown() const { lock_guard lg(m_mtxThreadCtl); return m_shutdown; }
-    bool doTerminate() const { lock_guard lg(m_mtxThreadCtl); return m_terminate; }
+    void setBooted(bool state) { m_booted.store(state, std::memory_order_release); }
+    bool doShutdown() const { return m_shutdown.load(std::memory_order_acquire); }
+    bool doTerminate() const { return m_terminate.load(std::memory_order_acquire); }
     // clang-format on
 };
 
@@ -0,0 +1,157 @@
+/*
+author          Oliver Blaser
+date            18.10.2026
+copyright       MIT - Copyright (c) 2026 Oliver Blaser
+*/
+
+#ifndef IG_CURLTHREAD_TIMERWHEEL_H
+#define IG_CURLTHREAD_TIMERWHEEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+namespace curl {
+
+/**
+ * @brief Hierarchical timer wheel.
+ *
+ * Consists of `levels` wheels with 64 slots each. A slot of level 0 spans one tick, a slot of level _n_ spans 64^_n_
+ * ticks. Timers are put into the lowest level whose window contains the due tick, and are moved down (cascaded) when
+ * the current tick enters their slot. Timers beyond the range of the top level are kept in an overflow list, which is
+ * cascaded whenever the top level wraps around.
+ *
+ * Insert is O(1). Expiry is O(1) per tick and timer, each timer is cascaded at most `levels` times.
+ *
+ * Not thread safe.
+ *
+ * @tparam T Value type, should be cheap to copy
+ */
+template <typename T> class TimerWheel
+{
+public:
+    static constexpr int slotBits = 6;
+    static constexpr int nSlots = (1 << slotBits);
+    static constexpr int levels = 4;
+
+private:
+    struct Entry
+    {
+        Entry(int64_t due_, const T& value_)
+            : due(due_), value(value_)
+        {}
+
+        int64_t due;
+        T value;
+    };
+
+    using slot_type = std::vector<Entry>;
+
+public:
+    TimerWheel()
+        : m_now(0), m_size(0), m_wheel(levels * nSlots), m_overflow()
+    {}
+
+    virtual ~TimerWheel() {}
+
+    size_t size() const { return m_size; }
+    bool empty() const { return (m_size == 0); }
+    int64_t now() const { return m_now; }
+
+    /**
+     * @brief Inserts a timer.
+     *
+     * Timers which are already due expire on the next tick. `advance()` should be called before inserting, so that the
+     * current tick of the wheel is up to date.
+     */
+    void insert(int64_t due, const T& value)
+    {
+        if (due <= m_now) { due = m_now + 1; }
+        m_place(Entry(due, value));
+        ++m_size;
+    }
+
+    /**
+     * @brief Advances the wheel to `now` and calls `fn(const T&)` for every expired timer.
+     *
+     * `fn` may insert new timers. If the wheel is empty, it jumps directly to `now`.
+     */
+    template <class Fn> void advance(int64_t now, Fn fn)
+    {
+        if (m_size == 0)
+        {
+            if (now > m_now) { m_now = now; }
+            return;
+        }
+
+        while ((m_now < now) && (m_size > 0))
+        {
+            ++m_now;
+
+            // cascade from the top down, so that timers can flow through several levels in the same tick
+            int top = 0;
+            while ((top < levels) && ((m_now & ((int64_t(1) << (slotBits * (top + 1))) - 1)) == 0)) { ++top; }
+
+            if (top == levels) { m_cascade(m_overflow); }
+            for (int level = (top < levels ? top : levels - 1); level > 0; --level) { m_cascade(m_slot(level, m_index(level, m_now))); }
+
+            slot_type expired;
+            expired.swap(m_slot(0, m_index(0, m_now)));
+            m_size -= expired.size();
+
+            for (size_t i = 0; i < expired.size(); ++i) { fn(expired[i].value); }
+        }
+
+        if (m_size == 0) { m_now = now; }
+    }
+
+    /**
+     * @brief Number of ticks until the next timer can expire at the earliest, or -1 if the wheel is empty.
+     *
+     * Only level 0 is scanned, the result is a lower bound of at most 64 ticks.
+     */
+    int64_t nextExpiry() const
+    {
+        if (m_size == 0) { return -1; }
+
+        const int64_t windowEnd = (m_now | (nSlots - 1)) + 1;
+
+        for (int64_t t = m_now + 1; t < windowEnd; ++t)
+        {
+            if (!m_wheel[m_index(0, t)].empty()) { return (t - m_now); }
+        }
+
+        return (windowEnd - m_now);
+    }
+
+private:
+    int64_t m_now;
+    size_t m_size;
+    std::vector<slot_type> m_wheel;
+    slot_type m_overflow;
+
+    static size_t m_index(int level, int64_t tick) { return (size_t)((tick >> (slotBits * level)) & (nSlots - 1)); }
+    slot_type& m_slot(int level, size_t index) { return m_wheel[(level * nSlots) + index]; }
+
+    void m_place(const Entry& e)
+    {
+        int level = 0;
+        while ((level < levels) && ((e.due >> (slotBits * (level + 1))) != (m_now >> (slotBits * (level + 1))))) { ++level; }
+
+        if (level < levels) { m_slot(level, m_index(level, e.due)).push_back(e); }
+        else { m_overflow.push_back(e); }
+    }
+
+    void m_cascade(slot_type& slot)
+    {
+        slot_type tmp;
+        tmp.swap(slot);
+        for (size_t i = 0; i < tmp.size(); ++i) { m_place(tmp[i]); }
+    }
+};
+
+} // namespace curl
+
+
+#endif // IG_CURLTHREAD_TIMERWHEEL_H
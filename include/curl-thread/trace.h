@@ -0,0 +1,115 @@
+/*
+author          Oliver Blaser
+date            18.10.2026
+copyright       MIT - Copyright (c) 2026 Oliver Blaser
+*/
+
+#ifndef IG_CURLTHREAD_TRACE_H
+#define IG_CURLTHREAD_TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+
+#if !defined(CURLTHREAD_CONFIG_TRACE_CAPACITY)
+#define CURLTHREAD_CONFIG_TRACE_CAPACITY (16384)
+#endif
+
+
+/**
+ * @brief Request lifecycle tracing.
+ *
+ * Once enabled, the request lifecycle (queued, dispatched, DNS, connect, TLS, first byte, done, popped) and the state
+ * transitions of `curl::thread()` are recorded into a lock free ring buffer of `CURLTHREAD_CONFIG_TRACE_CAPACITY`
+ * events. The oldest events are overwritten when the ring is full.
+ *
+ * The capture can be exported as Chrome trace event JSON and loaded in [Perfetto](https://ui.perfetto.dev) or
+ * `chrome://tracing`. Each request is shown as async spans `queued` → `transfer` → `awaitPop`, the transfer phases and
+ * the worker states are shown on the worker thread track.
+ *
+ * If tracing is disabled the cost of a trace point is a relaxed atomic load.
+ */
+namespace curl {
+namespace trace {
+
+    enum class Event
+    {
+        queued = 0,
+        dispatched,
+        dns,
+        connect,
+        tls,
+        firstByte,
+        transfer,
+        retry,
+        done,
+        popped,
+        state,
+    };
+
+    namespace detail {
+
+        extern std::atomic<bool> enabled;
+
+    }
+
+    static inline bool enabled() { return detail::enabled.load(std::memory_order_relaxed); }
+    void enable();
+    void disable();
+
+    /**
+     * @brief Discards all recorded events.
+     *
+     * Must not be called while tracing is enabled.
+     */
+    void clear();
+
+    /**
+     * @brief Returns the recorded events as Chrome trace event JSON.
+     *
+     * Events which are overwritten while exporting are skipped.
+     */
+    std::string toChromeJson();
+
+    /**
+     * @brief Writes `curl::trace::toChromeJson()` to a file.
+     *
+     * @return `true` on success
+     */
+    bool writeChromeJson(const std::string& filename);
+
+
+
+    //! \name Thread intern
+    /// @{
+
+    /**
+     * @brief Current time on the trace clock in nanoseconds.
+     */
+    int64_t now();
+
+    /**
+     * @brief Records an event.
+     *
+     * @param event Event type
+     * @param queueId Queue ID of the request
+     * @param ts_ns Timestamp, see `curl::trace::now()`
+     * @param dur_ns Duration, only used by span events (`dns`, `connect`, `tls`, `firstByte`, `transfer`, `state`)
+     * @param name Name of the span, only used by `Event::state`. Has to be a string literal (or have static storage
+     * duration), only the pointer is recorded.
+     */
+    void record(Event event, int queueId, int64_t ts_ns, int64_t dur_ns = 0, const char* name = nullptr);
+
+    static inline void record(Event event, int queueId)
+    {
+        if (enabled()) { record(event, queueId, now()); }
+    }
+
+    /// @}
+
+} // namespace trace
+} // namespace curl
+
+
+#endif // IG_CURLTHREAD_TRACE_H
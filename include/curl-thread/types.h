@@ -7,16 +7,31 @@ copyright       MIT - Copyright (c) 2025 Oliver Blaser
 #ifndef IG_CURLTHREAD_TYPES_H
 #define IG_CURLTHREAD_TYPES_H
 
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 
 
+struct curl_slist;
+
 namespace curl {
 
+/**
+ * On Windows `DELETE` is a macro of `winnt.h`, it has to be undefined to use `curl::Method::DELETE` after including
+ * `Windows.h`.
+ */
 enum class Method
 {
     GET = 0,
     POST,
+    PUT,
+    PATCH,
+    DELETE,
+    HEAD, ///< The response has no body, it's not transferred
 };
 
 enum class Priority
@@ -33,15 +48,12 @@ class QueueId
 public:
     enum
     {
+        OVER_BUDGET = -3, ///< Rejected by the byte budget, see `curl::ByteBudget`
         FAILED = -2,
         NONE = -1,
         BASE = 1, ///< The first assigned queue id
 
-#if defined(CURLTHREAD_CONFIG_MAX_QUEUE_ITEMS)
-        MAX = CURLTHREAD_CONFIG_MAX_QUEUE_ITEMS,
-#else
-        MAX = 1024, ///< The last assigned queue id
-#endif
+        MAX = 1024, ///< The last queue id, the capacity of a queue policy can't exceed it (see `curl::BasicThreadSharedData`)
     };
 
     using id_type = int;
@@ -67,6 +79,51 @@ private:
     id_type m_id;
 };
 
+/**
+ * @brief Non owning reference to a character sequence.
+ *
+ * Like `std::string_view`, but available in C++11. The referenced data has to outlive the view.
+ */
+class StringView
+{
+public:
+    StringView()
+        : m_data(""), m_size(0)
+    {}
+
+    StringView(const char* data, size_t size)
+        : m_data(data), m_size(size)
+    {}
+
+    StringView(const char* str)
+        : m_data(str), m_size(std::strlen(str))
+    {}
+
+    StringView(const std::string& str)
+        : m_data(str.data()), m_size(str.size())
+    {}
+
+    virtual ~StringView() {}
+
+    const char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+    bool empty() const { return (m_size == 0); }
+
+    std::string str() const { return std::string(m_data, m_size); }
+
+    bool operator==(const StringView& other) const;
+    bool operator!=(const StringView& other) const { return !(*this == other); }
+
+    /**
+     * @brief ASCII case insensitive comparison, as used for HTTP header field names.
+     */
+    bool equalsIgnoreCase(const StringView& other) const;
+
+private:
+    const char* m_data;
+    size_t m_size;
+};
+
 class HeaderField
 {
 private:
@@ -76,20 +133,332 @@ public:
     HeaderField() = delete;
 
     HeaderField(const std::string& key, const std::string& value)
-        : m_curlStr(key + delimiter + value)
+        : m_curlStr(key + delimiter + value), m_keySize(key.size())
     {}
 
     virtual ~HeaderField() {}
 
     bool empty() const { return (m_curlStr == delimiter); }
 
-    std::string key() const;
+    std::string key() const { return m_curlStr.substr(0, m_keySize); }
     std::string value() const;
 
+    /**
+     * @brief Same as `key()` but without allocation.
+     *
+     * The view is valid as long as the header field exists.
+     */
+    StringView keyView() const { return StringView(m_curlStr.data(), m_keySize); }
+    StringView valueView() const;
+
     const char* curlStr() const { return m_curlStr.c_str(); }
 
 private:
     std::string m_curlStr;
+    size_t m_keySize;
+};
+
+/**
+ * @brief Immutable set of header fields.
+ *
+ * The curl header list is built once on construction, requests using a header set don't build nor allocate a header
+ * list when they are performed. A header set can be shared by any number of requests, see `curl::HeaderSetPtr`.
+ */
+class HeaderSet
+{
+public:
+    HeaderSet() = delete;
+    explicit HeaderSet(const std::vector<HeaderField>& fields);
+    virtual ~HeaderSet();
+
+    size_t size() const { return m_fields.size(); }
+    const HeaderField& operator[](size_t i) const { return m_fields[i]; }
+    const std::vector<HeaderField>& fields() const { return m_fields; }
+
+    /**
+     * @brief Finds the first field with the key (case insensitive).
+     *
+     * @return The field, or `nullptr` if there is no such field
+     */
+    const HeaderField* find(const StringView& key) const;
+
+    /**
+     * @brief The curl header list, `nullptr` if the set is empty.
+     */
+    curl_slist* curlList() const { return m_list; }
+
+private:
+    std::vector<HeaderField> m_fields;
+    curl_slist* m_list;
+
+    HeaderSet(const HeaderSet& other) = delete;
+    HeaderSet& operator=(const HeaderSet& other) = delete;
+};
+
+using HeaderSetPtr = std::shared_ptr<const HeaderSet>;
+
+static inline HeaderSetPtr makeHeaderSet(const std::vector<HeaderField>& fields) { return std::make_shared<const HeaderSet>(fields); }
+
+/**
+ * @brief Read only memory mapping of a file.
+ *
+ * The whole file is mapped on construction, an empty file or a file which could not be mapped results in an invalid
+ * mapping. Not copyable, see `curl::MappedFilePtr`.
+ */
+class MappedFile
+{
+public:
+    MappedFile() = delete;
+
+    /**
+     * @param removeOnClose Remove the file once it's not needed anymore. On POSIX systems it's unlinked right after
+     * mapping it, otherwise when the mapping is destroyed.
+     */
+    MappedFile(const std::string& filename, bool removeOnClose);
+
+    virtual ~MappedFile();
+
+    bool isValid() const { return m_valid; }
+    const char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+    StringView view() const { return StringView(m_data, m_size); }
+    const std::string& filename() const { return m_filename; }
+
+private:
+    std::string m_filename;
+    bool m_removeOnClose;
+    bool m_valid;
+    const char* m_data;
+    size_t m_size;
+#ifdef _WIN32
+    void* m_hFile;
+    void* m_hMapping;
+#endif
+
+    MappedFile(const MappedFile& other) = delete;
+    MappedFile& operator=(const MappedFile& other) = delete;
+};
+
+using MappedFilePtr = std::shared_ptr<const MappedFile>;
+
+/**
+ * @brief Streamed request body.
+ *
+ * The body is read in chunks while it's sent, it doesn't need to be in memory. If the size is unknown, chunked
+ * transfer encoding is used. Every attempt (see `curl::RetryPolicy`) reads the body from the beginning.
+ */
+class UploadSource
+{
+public:
+    enum class Type
+    {
+        file = 0,
+        fd,
+        mapping,
+        function,
+    };
+
+    /**
+     * @brief Reads the next chunk of the body into `buffer` (called by the curl thread).
+     *
+     * @param buffer Destination
+     * @param size Size of the buffer
+     * @param offset Number of bytes already read by this attempt, 0 at the beginning of every attempt
+     * @return Number of bytes read, 0 at the end of the body, or `curl::UploadSource::abortTransfer`
+     */
+    using ReadFunction = std::function<size_t(char* buffer, size_t size, int64_t offset)>;
+
+    static const size_t abortTransfer; ///< Return value of a `ReadFunction` to abort the transfer
+
+public:
+    UploadSource() = delete;
+
+    /**
+     * @brief Uploads a file, the size is determined when the transfer starts.
+     */
+    explicit UploadSource(const std::string& filename)
+        : m_type(Type::file), m_filename(filename), m_fd(-1), m_file(), m_function(), m_size(-1)
+    {}
+
+    /**
+     * @brief Uploads from a file descriptor, which is rewound to the beginning if possible.
+     *
+     * The file descriptor has to stay open until the response is set.
+     *
+     * @param size Size of the body, -1 if unknown
+     */
+    UploadSource(int fd, int64_t size)
+        : m_type(Type::fd), m_filename(), m_fd(fd), m_file(), m_function(), m_size(size)
+    {}
+
+    /**
+     * @brief Uploads a mapped file, e.g. the body of a previous download (see `curl::Response::file()`).
+     */
+    explicit UploadSource(const MappedFilePtr& file)
+        : m_type(Type::mapping), m_filename(), m_fd(-1), m_file(file), m_function(), m_size(file ? (int64_t)file->size() : 0)
+    {}
+
+    /**
+     * @param size Size of the body, -1 if unknown
+     */
+    UploadSource(const ReadFunction& function, int64_t size)
+        : m_type(Type::function), m_filename(), m_fd(-1), m_file(), m_function(function), m_size(size)
+    {}
+
+    virtual ~UploadSource() {}
+
+    Type type() const { return m_type; }
+    const std::string& filename() const { return m_filename; }
+    int fd() const { return m_fd; }
+    const MappedFilePtr& file() const { return m_file; }
+    const ReadFunction& function() const { return m_function; }
+
+    /**
+     * @brief Size of the body, -1 if unknown. Always -1 for files.
+     */
+    int64_t size() const { return m_size; }
+
+private:
+    Type m_type;
+    std::string m_filename;
+    int m_fd;
+    MappedFilePtr m_file;
+    ReadFunction m_function;
+    int64_t m_size;
+};
+
+using UploadSourcePtr = std::shared_ptr<const UploadSource>;
+
+/**
+ * @brief Reference counted immutable string, see `curl::intern()`.
+ */
+using SharedString = std::shared_ptr<const std::string>;
+
+/**
+ * @brief Returns the shared instance of a string.
+ *
+ * Equal strings are stored only once, as long as they are referenced. Used for user agents and base URLs, which are
+ * the same for many requests. Thread safe.
+ */
+SharedString intern(const std::string& str);
+
+/**
+ * @brief Per request retry policy.
+ *
+ * Failed attempts are retried by the library, the owner of the request gets only the final response. A backing off
+ * request is held in a timer queue, it doesn't block the worker nor delay other requests.
+ *
+ * The delay before attempt _n_ + 1 is `baseDelay * 2^(n - 1)`, limited to `maxDelay`. The jitter randomly reduces the
+ * delay by up to `jitter` percent. If the response contains a `Retry-After` header and it's honoured, its value is used
+ * instead, as long as it's not greater than `maxDelay`. Otherwise the response is delivered without retrying.
+ */
+class RetryPolicy
+{
+public:
+    /**
+     * @brief Policy which never retries.
+     */
+    RetryPolicy()
+        : m_maxAttempts(1), m_baseDelay_ms(0), m_maxDelay_ms(0), m_jitter(0), m_retryAfter(false), m_curlCodes(), m_httpCodes()
+    {}
+
+    /**
+     * Retries on the default retryable curl codes (connect, timeout, send/receive errors) and HTTP codes (408, 429,
+     * 500, 502, 503, 504).
+     *
+     * @param maxAttempts Maximum number of attempts, including the first one
+     * @param baseDelay_ms Delay before the first retry
+     * @param maxDelay_ms Upper limit of the delay
+     */
+    explicit RetryPolicy(int maxAttempts, long baseDelay_ms = 500, long maxDelay_ms = 30000);
+
+    virtual ~RetryPolicy() {}
+
+    RetryPolicy(const RetryPolicy& other) = default;
+    RetryPolicy(RetryPolicy&& other) = default;
+    RetryPolicy& operator=(const RetryPolicy& other) = default;
+    RetryPolicy& operator=(RetryPolicy&& other) = default;
+
+    int maxAttempts() const { return m_maxAttempts; }
+    long baseDelay() const { return m_baseDelay_ms; }
+    long maxDelay() const { return m_maxDelay_ms; }
+    int jitter() const { return m_jitter; }
+    bool retryAfter() const { return m_retryAfter; }
+    const std::vector<int>& curlCodes() const { return m_curlCodes; }
+    const std::vector<int>& httpCodes() const { return m_httpCodes; }
+
+    /**
+     * @param jitter_percent Range [0, 100], default is 50
+     */
+    void setJitter(int jitter_percent) { m_jitter = jitter_percent; }
+    void setRetryAfter(bool honour) { m_retryAfter = honour; }
+    void setCurlCodes(const std::vector<int>& codes) { m_curlCodes = codes; }
+    void setHttpCodes(const std::vector<int>& codes) { m_httpCodes = codes; }
+
+    bool enabled() const { return (m_maxAttempts > 1); }
+
+    /**
+     * @brief Checks if a response is retryable, ignoring the number of attempts.
+     */
+    bool retryable(int curlCode, int httpCode) const;
+
+    /**
+     * @brief Returns the delay before the next attempt, including the jitter.
+     *
+     * @param attempt Number of performed attempts
+     */
+    long delay(int attempt) const;
+
+private:
+    int m_maxAttempts;
+    long m_baseDelay_ms;
+    long m_maxDelay_ms;
+    int m_jitter;
+    bool m_retryAfter;
+    std::vector<int> m_curlCodes;
+    std::vector<int> m_httpCodes;
+};
+
+/**
+ * @brief Per request hedging policy.
+ *
+ * If the request has not completed within the hedge delay, a duplicate is issued. The first successful response wins
+ * and the other transfer is aborted. A response is successful if curl reports no error and the HTTP status is not 5xx.
+ * If both fail, the response of the first attempt is delivered (and retried according to the retry policy).
+ *
+ * The hedge delay is the observed latency percentile of the host if set and enough samples have been collected,
+ * otherwise `delay`. The duplicates are limited globally, see `curl::setHedgeLimit()`.
+ *
+ * Only applied to `GET` and `HEAD` requests without a download file, other requests are performed once.
+ */
+class HedgePolicy
+{
+public:
+    /**
+     * @brief Policy which never hedges.
+     */
+    HedgePolicy()
+        : m_delay_ms(-1), m_percentile(0)
+    {}
+
+    /**
+     * @param delay_ms Hedge delay, -1 to hedge only once the percentile is known
+     * @param percentile Latency percentile of the host in the range (0, 100), 0 to always use `delay_ms`
+     */
+    explicit HedgePolicy(long delay_ms, double percentile = 0)
+        : m_delay_ms(delay_ms), m_percentile(percentile)
+    {}
+
+    virtual ~HedgePolicy() {}
+
+    long delay() const { return m_delay_ms; }
+    double percentile() const { return m_percentile; }
+
+    bool enabled() const { return ((m_delay_ms >= 0) || (m_percentile > 0)); }
+
+private:
+    long m_delay_ms;
+    double m_percentile;
 };
 
 class Request
@@ -101,33 +470,163 @@ public:
     Request() = delete;
 
     Request(const Method& method, const std::string& url, long connectTimeout = 0, long totalTimeout = 0, const std::string& userAgent = defaultUserAgent)
-        : m_method(method), m_url(url), m_connectTimeout(connectTimeout), m_totalTimeout(totalTimeout), m_userAgent(userAgent), m_header(), m_body()
+        : m_method(method),
+          m_baseUrl(),
+          m_url(url),
+          m_connectTimeout(connectTimeout),
+          m_totalTimeout(totalTimeout),
+          m_userAgent(curl::intern(userAgent)),
+          m_header(),
+          m_headerSet(),
+          m_body(),
+          m_retryPolicy(),
+          m_hedgePolicy(),
+          m_captureHeaders(false),
+          m_maxResponseSize(0),
+          m_download(false),
+          m_downloadFile(),
+          m_upload()
+    {}
+
+    /**
+     * The URL is `baseUrl` + `path`. The base URL is not copied, it's shared with all requests referring to it.
+     *
+     * @param baseUrl Base URL, see `curl::intern()`
+     * @param path The rest of the URL
+     */
+    Request(const Method& method, const SharedString& baseUrl, const std::string& path, long connectTimeout = 0, long totalTimeout = 0,
+            const std::string& userAgent = defaultUserAgent)
+        : m_method(method),
+          m_baseUrl(baseUrl),
+          m_url(path),
+          m_connectTimeout(connectTimeout),
+          m_totalTimeout(totalTimeout),
+          m_userAgent(curl::intern(userAgent)),
+          m_header(),
+          m_headerSet(),
+          m_body(),
+          m_retryPolicy(),
+          m_hedgePolicy(),
+          m_captureHeaders(false),
+          m_maxResponseSize(0),
+          m_download(false),
+          m_downloadFile(),
+          m_upload()
     {}
 
     virtual ~Request() {}
 
+    // the buffers are moved, not copied (the virtual destructor suppresses the implicit move operations)
+    Request(const Request& other) = default;
+    Request(Request&& other) = default;
+    Request& operator=(const Request& other) = default;
+    Request& operator=(Request&& other) = default;
+
     const Method& method() const { return m_method; }
-    const std::string& url() const { return m_url; }
+    std::string url() const { return (m_baseUrl ? (*m_baseUrl + m_url) : m_url); }
+    const SharedString& baseUrl() const { return m_baseUrl; }
+    const std::string& path() const { return m_url; } ///< The URL relative to `baseUrl()`, or the whole URL if there is no base URL
     long connectTimeout() const { return m_connectTimeout; }
     long totalTimeout() const { return m_totalTimeout; }
-    const std::string& userAgent() const { return m_userAgent; }
+    const std::string& userAgent() const { return *m_userAgent; }
     const std::vector<HeaderField>& header() const { return m_header; }
+    const HeaderSetPtr& headerSet() const { return m_headerSet; }
     const std::string& body() const { return m_body; }
+    const UploadSourcePtr& upload() const { return m_upload; }
+    const RetryPolicy& retryPolicy() const { return m_retryPolicy; }
+    const HedgePolicy& hedgePolicy() const { return m_hedgePolicy; }
+    bool captureHeaders() const { return m_captureHeaders; }
+    int64_t maxResponseSize() const { return m_maxResponseSize; }
+    bool download() const { return m_download; }
+    const std::string& downloadFile() const { return m_downloadFile; } ///< Empty if a temporary file is used
 
     void setBody(const std::string& body) { m_body = body; }
+
+    /**
+     * @brief Sets a streamed body, which is sent instead of `body()`.
+     *
+     * Only used by `POST`, `PUT`, `PATCH` and `DELETE` requests.
+     */
+    void setUpload(const UploadSource& source) { m_upload = std::make_shared<const UploadSource>(source); }
     void setHeader(const std::vector<HeaderField>& header) { m_header = header; }
     void addHeaderField(const HeaderField& headerField) { m_header.push_back(headerField); }
 
+    /**
+     * @brief Sets a shared header set.
+     *
+     * Can be combined with `setHeader()`/`addHeaderField()`, but then the header list has to be built on every
+     * transfer. Requests which use only a header set have no per request header allocations.
+     */
+    void setHeaderSet(const HeaderSetPtr& headerSet) { m_headerSet = headerSet; }
+    void setRetryPolicy(const RetryPolicy& policy) { m_retryPolicy = policy; }
+    void setHedgePolicy(const HedgePolicy& policy) { m_hedgePolicy = policy; }
+
+    /**
+     * @brief Sets an already interned user agent, which avoids the lookup done by the constructor.
+     */
+    void setUserAgent(const SharedString& userAgent)
+    {
+        if (userAgent) { m_userAgent = userAgent; }
+    }
+
+    /**
+     * @brief Enables capturing of the response headers, see `curl::Response::headers()`.
+     *
+     * Disabled by default, requests without header capture don't install a header callback.
+     */
+    void setCaptureHeaders(bool capture) { m_captureHeaders = capture; }
+
+    /**
+     * @brief Limits the size of the response body.
+     *
+     * Transfers which exceed the limit are aborted as soon as it's known, either by the announced `Content-Length`
+     * (`CURLOPT_MAXFILESIZE_LARGE`) or while receiving. They fail with `CURLE_FILESIZE_EXCEEDED` and an empty body.
+     *
+     * @param bytes Maximum size in bytes, 0 for unlimited (default)
+     */
+    void setMaxResponseSize(int64_t bytes) { m_maxResponseSize = bytes; }
+
+    /**
+     * @brief Writes the response body to a file instead of memory.
+     *
+     * The body is streamed to the file with large buffered writes, the response provides a read only mapping of the
+     * completed file, see `curl::Response::file()`. The file is overwritten by every attempt and is kept after a failed
+     * transfer.
+     */
+    void setDownloadFile(const std::string& filename)
+    {
+        m_download = true;
+        m_downloadFile = filename;
+    }
+
+    /**
+     * @brief Same as `setDownloadFile()`, but with a temporary file which is removed once the mapping is destroyed.
+     */
+    void setDownloadTempFile()
+    {
+        m_download = true;
+        m_downloadFile.clear();
+    }
+
     std::string toString() const;
 
 private:
     Method m_method;
-    std::string m_url;
+    SharedString m_baseUrl;
+    std::string m_url; // relative to `m_baseUrl` if there is one
     long m_connectTimeout;
     long m_totalTimeout;
-    std::string m_userAgent;
+    SharedString m_userAgent;
     std::vector<HeaderField> m_header;
+    HeaderSetPtr m_headerSet;
     std::string m_body;
+    RetryPolicy m_retryPolicy;
+    HedgePolicy m_hedgePolicy;
+    bool m_captureHeaders;
+    int64_t m_maxResponseSize;
+    bool m_download;
+    std::string m_downloadFile;
+    UploadSourcePtr m_upload;
 };
 
 class GetRequest : public Request
@@ -146,6 +645,11 @@ public:
         setHeader(header);
     }
 
+    GetRequest(const SharedString& baseUrl, const std::string& path, long connectTimeout = 0, long totalTimeout = 0,
+               const std::string& userAgent = defaultUserAgent)
+        : Request(Method::GET, baseUrl, path, connectTimeout, totalTimeout, userAgent)
+    {}
+
     virtual ~GetRequest() {}
 };
 
@@ -179,29 +683,208 @@ public:
         setHeader(header);
     }
 
+    PostRequest(const SharedString& baseUrl, const std::string& path, long connectTimeout = 0, long totalTimeout = 0,
+                const std::string& userAgent = defaultUserAgent)
+        : Request(Method::POST, baseUrl, path, connectTimeout, totalTimeout, userAgent)
+    {}
+
     virtual ~PostRequest() {}
 };
 
+class PutRequest : public Request
+{
+public:
+    PutRequest() = delete;
+
+    explicit PutRequest(const std::string& url, long connectTimeout = 0, long totalTimeout = 0, const std::string& userAgent = defaultUserAgent)
+        : Request(Method::PUT, url, connectTimeout, totalTimeout, userAgent)
+    {}
+
+    PutRequest(const std::string& url, long connectTimeout, long totalTimeout, const UploadSource& source, const std::string& userAgent = defaultUserAgent)
+        : Request(Method::PUT, url, connectTimeout, totalTimeout, userAgent)
+    {
+        setUpload(source);
+    }
+
+    virtual ~PutRequest() {}
+};
+
+class PatchRequest : public Request
+{
+public:
+    PatchRequest() = delete;
+
+    explicit PatchRequest(const std::string& url, long connectTimeout = 0, long totalTimeout = 0, const std::string& userAgent = defaultUserAgent)
+        : Request(Method::PATCH, url, connectTimeout, totalTimeout, userAgent)
+    {}
+
+    virtual ~PatchRequest() {}
+};
+
+class DeleteRequest : public Request
+{
+public:
+    DeleteRequest() = delete;
+
+    explicit DeleteRequest(const std::string& url, long connectTimeout = 0, long totalTimeout = 0, const std::string& userAgent = defaultUserAgent)
+        : Request(Method::DELETE, url, connectTimeout, totalTimeout, userAgent)
+    {}
+
+    virtual ~DeleteRequest() {}
+};
+
+/**
+ * @brief Probes a resource, only the status and the header are transferred.
+ */
+class HeadRequest : public Request
+{
+public:
+    HeadRequest() = delete;
+
+    explicit HeadRequest(const std::string& url, long connectTimeout = 0, long totalTimeout = 0, const std::string& userAgent = defaultUserAgent)
+        : Request(Method::HEAD, url, connectTimeout, totalTimeout, userAgent)
+    {}
+
+    virtual ~HeadRequest() {}
+};
+
+/**
+ * @brief Captured response header fields.
+ *
+ * All fields are stored in one contiguous buffer, the index holds the offsets and sizes of the keys and values and a
+ * hash of the lower case key. A lookup compares the hashes and only compares the strings of a matching hash. There is
+ * no allocation per field.
+ *
+ * Only the fields of the last response are kept, e.g. the fields of redirects and `100 Continue` are discarded.
+ */
+class ResponseHeaders
+{
+public:
+    ResponseHeaders()
+        : m_buffer(), m_index()
+    {}
+
+    virtual ~ResponseHeaders() {}
+
+    ResponseHeaders(const ResponseHeaders& other) = default;
+    ResponseHeaders(ResponseHeaders&& other) = default;
+    ResponseHeaders& operator=(const ResponseHeaders& other) = default;
+    ResponseHeaders& operator=(ResponseHeaders&& other) = default;
+
+    size_t size() const { return m_index.size(); }
+    bool empty() const { return m_index.empty(); }
+
+    StringView key(size_t i) const { return StringView(m_buffer.data() + m_index[i].key, m_index[i].keySize); }
+    StringView value(size_t i) const { return StringView(m_buffer.data() + m_index[i].value, m_index[i].valueSize); }
+
+    /**
+     * @brief Index of the first field with the key (case insensitive).
+     *
+     * @return The index, or -1 if there is no such field
+     */
+    int indexOf(const StringView& key) const;
+
+    bool contains(const StringView& key) const { return (indexOf(key) >= 0); }
+
+    /**
+     * @brief Value of the first field with the key (case insensitive).
+     *
+     * The view is valid as long as the object exists and is not modified.
+     *
+     * @return The value, or an empty view if there is no such field
+     */
+    StringView find(const StringView& key) const;
+
+    void clear();
+
+    /**
+     * @brief Parses a raw header line as received from the server (thread intern).
+     *
+     * A status line starts a new response and clears the previous fields, the empty line at the end is ignored.
+     */
+    void parseLine(const char* p, size_t size);
+
+private:
+    struct Entry
+    {
+        uint32_t key;
+        uint32_t keySize;
+        uint32_t value;
+        uint32_t valueSize;
+        uint32_t hash;
+    };
+
+    std::string m_buffer;
+    std::vector<Entry> m_index;
+
+    static uint32_t m_hash(const StringView& key);
+};
+
 class Response
 {
+public:
+    /**
+     * @brief curl-thread specific values of `curlCode()`.
+     *
+     * Negative, to not collide with `CURLcode`.
+     */
+    enum
+    {
+        E_CIRCUIT_OPEN = -100, ///< Not performed, the circuit breaker of the host is open
+        E_SHED = -101,         ///< Not performed, shed from the queue to admit another request, see `curl::ShedPolicy`
+        E_FILE = -102,         ///< The download or upload file could not be opened, read, written or mapped
+        E_NOT_QUEUED = -103,   ///< Not performed, the request could not be queued (see `curl::QueueId`)
+        E_SHUTDOWN = -104,     ///< Not performed or aborted, the drain deadline has passed (see `curl::shutdown()`)
+    };
+
 public:
     Response()
-        : m_curlCode(), m_httpCode(), m_body()
+        : m_curlCode(), m_httpCode(), m_body(), m_headers(), m_file()
     {
         m_clear();
     }
 
     Response(int curlCode, int httpCode, const std::string& body)
-        : m_curlCode(curlCode), m_httpCode(httpCode), m_body(body)
+        : m_curlCode(curlCode), m_httpCode(httpCode), m_body(body), m_headers(), m_file()
+    {}
+
+    Response(int curlCode, int httpCode, const std::string& body, const ResponseHeaders& headers)
+        : m_curlCode(curlCode), m_httpCode(httpCode), m_body(body), m_headers(headers), m_file()
     {}
 
     virtual ~Response() {}
 
+    Response(const Response& other) = default;
+    Response(Response&& other) = default;
+    Response& operator=(const Response& other) = default;
+    Response& operator=(Response&& other) = default;
+
     int curlCode() const { return m_curlCode; }
     int httpCode() const { return m_httpCode; }
     const std::string& body() const { return m_body; }
 
+    /**
+     * @brief The response header fields, empty if `curl::Request::setCaptureHeaders()` was not enabled.
+     */
+    const ResponseHeaders& headers() const { return m_headers; }
+
+    /**
+     * @brief Mapping of the downloaded body, `nullptr` if the body is in memory or the transfer failed.
+     *
+     * See `curl::Request::setDownloadFile()`.
+     */
+    const MappedFilePtr& file() const { return m_file; }
+
+    /**
+     * @brief The body, either the in memory one or the mapped file.
+     */
+    StringView bodyView() const { return (m_file ? m_file->view() : StringView(m_body)); }
+
+    void setFile(const MappedFilePtr& file) { m_file = file; }
+
     bool aborted() const;
+    bool circuitOpen() const { return (m_curlCode == E_CIRCUIT_OPEN); }
+    bool shed() const { return (m_curlCode == E_SHED); }
     bool curlOk() const; // curlCode == CURLE_OK (0)
     bool httpOk() const { return (m_httpCode == 200); }
     bool good() const { return (curlOk() && httpOk()); }
@@ -216,6 +899,383 @@ private:
     int m_curlCode;
     int m_httpCode;
     std::string m_body;
+    ResponseHeaders m_headers;
+    MappedFilePtr m_file;
+};
+
+/**
+ * @brief How the response of a request is delivered.
+ */
+enum class Delivery
+{
+    popResponse = 0, ///< See `curl::responseReady()` and `curl::popResponse()`
+    completionFd,    ///< See `curl::completionFd()` and `curl::drainCompletions()`
+};
+
+/**
+ * @brief A response together with the queue ID of its request.
+ */
+class Completion
+{
+public:
+    Completion()
+        : m_queueId(), m_response()
+    {}
+
+    Completion(const QueueId& queueId, const Response& response)
+        : m_queueId(queueId), m_response(response)
+    {}
+
+    virtual ~Completion() {}
+
+    const QueueId& queueId() const { return m_queueId; }
+    const Response& response() const { return m_response; }
+
+private:
+    QueueId m_queueId;
+    Response m_response;
+};
+
+enum class CircuitState
+{
+    closed = 0,
+    open,
+    halfOpen,
+};
+
+/**
+ * @brief Configuration of the per host circuit breakers.
+ *
+ * A breaker opens if `consecutiveFailures` requests in a row failed, or if at least `errorRate` of the last `window`
+ * requests failed. A request failed if curl reports an error or the HTTP status is 5xx. While a breaker is open, the
+ * requests to its host fail immediately with `curl::Response::E_CIRCUIT_OPEN`. After `openDuration` the breaker is
+ * half open and lets `halfOpenProbes` requests through, if they succeed it closes, otherwise it opens again.
+ */
+class CircuitBreakerConfig
+{
+public:
+    /**
+     * @brief Disabled circuit breakers.
+     */
+    CircuitBreakerConfig()
+        : m_consecutiveFailures(0), m_openDuration_ms(0), m_errorRate(0), m_window(0), m_halfOpenProbes(0)
+    {}
+
+    /**
+     * @param consecutiveFailures Threshold of consecutive failures, 0 to disable
+     * @param openDuration_ms Time the breaker stays open
+     * @param errorRate Error rate threshold in the range [0, 1], 0 to disable
+     * @param window Number of the last requests the error rate is based on
+     */
+    explicit CircuitBreakerConfig(int consecutiveFailures, long openDuration_ms = 30000, double errorRate = 0, int window = 20)
+        : m_consecutiveFailures(consecutiveFailures), m_openDuration_ms(openDuration_ms), m_errorRate(errorRate), m_window(window), m_halfOpenProbes(1)
+    {}
+
+    virtual ~CircuitBreakerConfig() {}
+
+    int consecutiveFailures() const { return m_consecutiveFailures; }
+    long openDuration() const { return m_openDuration_ms; }
+    double errorRate() const { return m_errorRate; }
+    int window() const { return m_window; }
+    int halfOpenProbes() const { return m_halfOpenProbes; }
+
+    void setHalfOpenProbes(int n) { m_halfOpenProbes = n; }
+
+    bool enabled() const { return ((m_consecutiveFailures > 0) || ((m_errorRate > 0) && (m_window > 0))); }
+
+private:
+    int m_consecutiveFailures;
+    long m_openDuration_ms;
+    double m_errorRate;
+    int m_window;
+    int m_halfOpenProbes;
+};
+
+/**
+ * @brief Byte budget for queued request bodies and buffered responses.
+ *
+ * A queued request is charged with the size of its body. Once the response is set, the charge is replaced by the size
+ * of the response body, and it's released when the response is popped. A request is admitted if the charges including
+ * its own are within the total limit and within the limit of its priority. Limits of 0 are unlimited.
+ *
+ * Responses are always delivered, even if they exceed the budget. They block the admission of new requests until they
+ * are popped, see also `curl::Request::setMaxResponseSize()`.
+ */
+class ByteBudget
+{
+public:
+    /**
+     * @brief Unlimited budget.
+     */
+    ByteBudget()
+        : m_total(0), m_normal(0), m_high(0), m_max(0)
+    {}
+
+    explicit ByteBudget(size_t total)
+        : m_total(total), m_normal(0), m_high(0), m_max(0)
+    {}
+
+    virtual ~ByteBudget() {}
+
+    size_t total() const { return m_total; }
+    size_t limit(const Priority& priority) const;
+
+    void setLimit(const Priority& priority, size_t limit);
+
+    bool enabled() const { return ((m_total > 0) || (m_normal > 0) || (m_high > 0) || (m_max > 0)); }
+
+private:
+    size_t m_total;
+    size_t m_normal;
+    size_t m_high;
+    size_t m_max;
+};
+
+enum class ShedPolicy
+{
+    reject = 0,         ///< New requests are rejected if the queue is full
+    evictLowerPriority, ///< The oldest request of the lowest queued priority below the new one is shed
+    dropOldest,         ///< The oldest request of the same priority is shed
+};
+
+/**
+ * @brief Configuration of the load shedding.
+ *
+ * The capacity limits the number of queued requests (not yet dispatched), the reserves keep a part of it free for
+ * requests of at least that priority. A request is admitted if the number of queued requests is below the capacity
+ * minus the reserves of the higher priorities. Otherwise the policy either sheds queued requests to make room, or the
+ * new request is rejected with `curl::QueueId::FAILED`.
+ *
+ * Shed requests complete with `curl::Response::E_SHED`. Their queue IDs stay reserved until the owner pops that
+ * response, so the capacity should be well below the number of queue IDs.
+ */
+class ShedConfig
+{
+public:
+    /**
+     * @brief No capacity limit, requests are only limited by the number of queue IDs.
+     */
+    ShedConfig()
+        : m_policy(ShedPolicy::reject), m_capacity(0), m_reserveHigh(0), m_reserveMax(0)
+    {}
+
+    /**
+     * @param capacity Maximum number of queued requests, 0 for unlimited
+     */
+    explicit ShedConfig(ShedPolicy policy, size_t capacity = (QueueId::MAX / 2))
+        : m_policy(policy), m_capacity(capacity), m_reserveHigh(0), m_reserveMax(0)
+    {}
+
+    virtual ~ShedConfig() {}
+
+    ShedPolicy policy() const { return m_policy; }
+    size_t capacity() const { return m_capacity; }
+
+    /**
+     * @brief Capacity reserved for requests of at least `priority`.
+     */
+    size_t reserve(const Priority& priority) const;
+
+    void setReserve(const Priority& priority, size_t n);
+
+    /**
+     * @brief Capacity available to requests of `priority`.
+     */
+    size_t limit(const Priority& priority) const;
+
+private:
+    ShedPolicy m_policy;
+    size_t m_capacity;
+    size_t m_reserveHigh;
+    size_t m_reserveMax;
+};
+
+enum class BatchFraming
+{
+    ndjson = 0, ///< One body per line, `Content-Type: application/x-ndjson`
+    jsonArray,  ///< The bodies are the elements of a JSON array, `Content-Type: application/json`
+    custom,     ///< See `curl::BatchConfig::setJoiner()`
+};
+
+/**
+ * @brief Configuration of the batching of an endpoint, see `curl::setBatching()`.
+ *
+ * Small `POST` bodies are collected until there are `maxItems` of them, their size reaches `maxBytes` or `maxDelay`
+ * has passed since the first one. Then they are joined according to the framing and sent as one request, which is
+ * queued with the priority of the first one.
+ */
+class BatchConfig
+{
+public:
+    /**
+     * @brief No batching.
+     */
+    BatchConfig()
+        : m_maxItems(0), m_maxDelay_ms(0), m_maxItemSize(0), m_maxBytes(0), m_framing(BatchFraming::ndjson), m_prefix(), m_separator(), m_suffix(),
+          m_contentType()
+    {}
+
+    /**
+     * @param maxItems Maximum number of requests per batch
+     * @param maxDelay_ms Maximum time a request waits for the batch to fill up
+     */
+    explicit BatchConfig(size_t maxItems, long maxDelay_ms = 10, BatchFraming framing = BatchFraming::ndjson);
+
+    virtual ~BatchConfig() {}
+
+    size_t maxItems() const { return m_maxItems; }
+    long maxDelay() const { return m_maxDelay_ms; }
+    size_t maxItemSize() const { return m_maxItemSize; }
+    size_t maxBytes() const { return m_maxBytes; }
+    BatchFraming framing() const { return m_framing; }
+    const std::string& contentType() const { return m_contentType; }
+
+    /**
+     * @brief Requests with a larger body are sent on their own, default is 4 KiB.
+     */
+    void setMaxItemSize(size_t bytes) { m_maxItemSize = bytes; }
+
+    /**
+     * @brief The batch is sent once the joined bodies reach this size, default is 64 KiB.
+     */
+    void setMaxBytes(size_t bytes) { m_maxBytes = bytes; }
+
+    /**
+     * @brief Sets a custom framing, the batch body is `prefix` + the bodies separated by `separator` + `suffix`.
+     *
+     * @param contentType Replaces the `Content-Type` header field of the batch, if not empty
+     */
+    void setJoiner(const std::string& prefix, const std::string& separator, const std::string& suffix, const std::string& contentType = "");
+
+    std::string join(const std::vector<const std::string*>& bodies) const;
+
+    bool enabled() const { return (m_maxItems > 0); }
+
+private:
+    size_t m_maxItems;
+    long m_maxDelay_ms;
+    size_t m_maxItemSize;
+    size_t m_maxBytes;
+    BatchFraming m_framing;
+    std::string m_prefix;
+    std::string m_separator;
+    std::string m_suffix;
+    std::string m_contentType;
+};
+
+/**
+ * @brief Called on the curl thread with the response of a replayed request, see `curl::openSpool()`.
+ */
+using ReplayHandler = std::function<void(const curl::Request&, const curl::Response&)>;
+
+/**
+ * @brief Configuration of the request spool, see `curl::openSpool()`.
+ */
+class SpoolConfig
+{
+public:
+    /**
+     * @param capacity Size of the ring in bytes, only used if the file is created
+     * @param commitInterval_ms Maximum time an appended request is not synced to the disk
+     */
+    explicit SpoolConfig(size_t capacity = 16 * 1024 * 1024, long commitInterval_ms = 10)
+        : m_capacity(capacity), m_commitInterval_ms(commitInterval_ms), m_spooled(), m_replayHandler()
+    {
+        for (size_t i = 0; i < 3; ++i) { m_spooled[i] = false; }
+    }
+
+    virtual ~SpoolConfig() {}
+
+    size_t capacity() const { return m_capacity; }
+    long commitInterval() const { return m_commitInterval_ms; }
+    bool spooled(const Priority& priority) const { return m_spooled[(int)priority]; }
+    const ReplayHandler& replayHandler() const { return m_replayHandler; }
+
+    /**
+     * @brief Selects the priorities whose requests are spooled, none by default.
+     */
+    void setSpooled(const Priority& priority, bool spooled = true) { m_spooled[(int)priority] = spooled; }
+
+    /**
+     * @brief Sets the handler of the replayed requests, their responses are discarded if there is none.
+     */
+    void setReplayHandler(const ReplayHandler& handler) { m_replayHandler = handler; }
+
+private:
+    size_t m_capacity;
+    long m_commitInterval_ms;
+    bool m_spooled[3]; // indexed by priority
+    ReplayHandler m_replayHandler;
+};
+
+/**
+ * @brief Configuration of the sharded submission, see `curl::setSharding()`.
+ */
+class ShardConfig
+{
+public:
+    /**
+     * @param shards Number of shards, the producer threads are assigned to them round robin. 0 disables sharding.
+     * @param ringCapacity Capacity of the ring of each shard and priority, rounded up to a power of two
+     */
+    explicit ShardConfig(size_t shards = 16, size_t ringCapacity = 64)
+        : m_shards(shards), m_ringCapacity(ringCapacity)
+    {}
+
+    virtual ~ShardConfig() {}
+
+    size_t shards() const { return m_shards; }
+    size_t ringCapacity() const { return m_ringCapacity; }
+
+private:
+    size_t m_shards;
+    size_t m_ringCapacity;
+};
+
+/**
+ * @brief Snapshot of the library state and counters.
+ */
+struct Stats
+{
+    struct Breaker
+    {
+        std::string host;
+        CircuitState state;
+        int consecutiveFailures;
+        int windowRequests; // number of requests in the error rate window
+        int windowFailures;
+        uint64_t rejected; // requests which failed fast
+    };
+
+    size_t qNormal;
+    size_t qHigh;
+    size_t qMax;
+    size_t qDelayed;  // requests backing off before a retry
+    size_t scheduled; // pending scheduled and recurring requests
+
+    uint64_t queued;     // requests accepted by `queueRequest()` or fired by a schedule
+    uint64_t dispatched; // attempts popped by the worker, including retries
+    uint64_t retried;
+    uint64_t completed; // final responses
+    uint64_t rejected;  // requests which failed fast due to an open circuit breaker
+
+    size_t budgetUsed;   // bytes charged to the byte budget
+    uint64_t overBudget; // requests which have not been admitted by the byte budget
+    uint64_t shed;       // requests which have been shed, see `curl::ShedPolicy`
+
+    uint64_t hedged;    // duplicates issued, see `curl::HedgePolicy`
+    uint64_t hedgeWins; // responses delivered from the duplicate
+
+    uint64_t batches; // batched requests which have been queued, see `curl::setBatching()`
+    uint64_t batched; // requests which have been sent as part of a batch
+
+    uint64_t spooled;      // requests which have been appended to the spool, see `curl::openSpool()`
+    uint64_t spoolFull;    // requests which have not been spooled because the spool was full
+    uint64_t spoolCommits; // syncs of the spool file
+
+    uint64_t sharded; // requests which have been queued through a shard, see `curl::setSharding()`
+
+    std::vector<Breaker> breakers;
 };
 
 } // namespace curl
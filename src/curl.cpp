@@ -4,13 +4,22 @@ date            01.03.2025
 copyright       MIT - Copyright (c) 2025 Oliver Blaser
 */
 
+#include <algorithm>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <list>
 #include <random>
 #include <string>
+#include <unordered_map>
 
 #include "../include/curl-thread/curl.h"
 #include "../include/curl-thread/thread.h"
+#include "../include/curl-thread/trace.h"
 #include "../include/curl-thread/types.h"
 
 // VS Properties:
@@ -22,7 +31,15 @@ copyright       MIT - Copyright (c) 2025 Oliver Blaser
 
 #ifdef _WIN32
 #include <Windows.h>
+#include <io.h>
+#undef DELETE // conflicts with curl::Method::DELETE
 #else
+#include <fcntl.h>
+#include <sys/mman.h>
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
+#include <sys/stat.h>
 #include <unistd.h>
 #endif
 
@@ -45,43 +62,6 @@ copyright       MIT - Copyright (c) 2025 Oliver Blaser
 #endif
 
 
-#ifdef CURLTHREAD_CONFIG_DEBUG_print_queueId_vector
-
-#define DEBUG_print_queueId_vector_before()                                                                                                    \
-    auto print_queueId_vector = [&]() {                                                                                                        \
-        std::string str = "    m_queueId: [";                                                                                                  \
-        for (size_t i = 0; i < m_queueId.size(); ++i) { str += " " + std::to_string(m_queueId[i]); }                                           \
-        if (m_queueId.size() > 0) { str += " "; }                                                                                              \
-        str += "]";                                                                                                                            \
-        return str;                                                                                                                            \
-    };                                                                                                                                         \
-    const bool print_queueId_vector_enable = (m_queueId.size() > 1);                                                                           \
-    if (print_queueId_vector_enable)                                                                                                           \
-    {                                                                                                                                          \
-        std::string queueId_vector_str = "\033[90m";                                                                                           \
-        queueId_vector_str += "CURLTHREAD " + std::string(__func__) + ":" + std::to_string(__LINE__) + "    id: " + std::to_string(id) + "\n"; \
-        queueId_vector_str += print_queueId_vector();                                                                                          \
-        queueId_vector_str += "\033[39m";                                                                                                      \
-        printf("%s\n", queueId_vector_str.c_str());                                                                                            \
-    }                                                                                                                                          \
-    // LOG_DBG();
-
-#define DEBUG_print_queueId_vector_after()            \
-    if (print_queueId_vector_enable)                  \
-    {                                                 \
-        std::string queueId_vector_str = "\033[90m";  \
-        queueId_vector_str += print_queueId_vector(); \
-        queueId_vector_str += "\033[39m";             \
-        printf("%s\n", queueId_vector_str.c_str());   \
-    }                                                 \
-    // LOG_DBG();
-
-#else // CURLTHREAD_CONFIG_DEBUG_print_queueId_vector
-
-#define DEBUG_print_queueId_vector_before() (void)0
-#define DEBUG_print_queueId_vector_after()  (void)0
-
-#endif // CURLTHREAD_CONFIG_DEBUG_print_queueId_vector
 
 
 namespace curl {
@@ -129,11 +109,270 @@ namespace util {
 #endif
     }
 
+    /**
+     * @brief Monotonic time in milliseconds.
+     */
+    int64_t steadyTime_ms()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    /**
+     * @brief Extracts the host (lower case) of an URL.
+     *
+     * User info and port are removed, IPv6 addresses keep their brackets.
+     */
+    std::string urlHost(const std::string& url)
+    {
+        size_t begin = url.find("://");
+        begin = ((begin == std::string::npos) ? 0 : begin + 3);
+
+        size_t end = url.find_first_of("/?#", begin);
+        if (end == std::string::npos) { end = url.size(); }
+
+        const size_t at = url.rfind('@', end);
+        if ((at != std::string::npos) && (at >= begin)) { begin = at + 1; }
+
+        size_t portDelim = url.rfind(':', end);
+        if ((portDelim != std::string::npos) && (portDelim >= begin) && (url.find(']', portDelim) > end)) { end = portDelim; }
+
+        std::string host = url.substr(begin, end - begin);
+        for (size_t i = 0; i < host.size(); ++i)
+        {
+            if ((host[i] >= 'A') && (host[i] <= 'Z')) { host[i] = (char)(host[i] - 'A' + 'a'); }
+        }
+
+        return host;
+    }
+
 } // namespace util
 } // namespace curl
 
 namespace {
 
+/**
+ * Entries are removed lazily, expired entries are swept once the map has doubled in size since the last sweep.
+ */
+class InternPool : public thread::SharedData
+{
+public:
+    InternPool()
+        : m_map(), m_sweepAt(64)
+    {}
+
+    virtual ~InternPool() {}
+
+    curl::SharedString get(const std::string& str)
+    {
+        lock_guard lg(m_mtx);
+
+        std::weak_ptr<const std::string>& entry = m_map[str];
+        curl::SharedString sp = entry.lock();
+
+        if (!sp)
+        {
+            sp = std::make_shared<const std::string>(str);
+            entry = sp;
+
+            if (m_map.size() >= m_sweepAt)
+            {
+                for (auto it = m_map.begin(); it != m_map.end();)
+                {
+                    if (it->second.expired()) { it = m_map.erase(it); }
+                    else { ++it; }
+                }
+
+                m_sweepAt = 2 * (m_map.size() > 32 ? m_map.size() : 32);
+            }
+        }
+
+        return sp;
+    }
+
+private:
+    std::unordered_map<std::string, std::weak_ptr<const std::string>> m_map;
+    size_t m_sweepAt;
+};
+
+InternPool& internPool()
+{
+    static InternPool pool;
+    return pool;
+}
+
+// stdio buffer size of the download and upload files
+CONSTEXPR size_t fileBufferSize = 1024 * 1024;
+
+struct WriteBuffer
+{
+    std::string data;
+    FILE* fp; // if set, the body is written to the file instead of `data`
+    int64_t size;
+    int64_t maxSize; // 0 for unlimited
+    bool exceeded;
+    bool writeError;
+};
+
+struct UploadReader
+{
+    const curl::UploadSource* source;
+    FILE* fp; // if the source is a file
+    int64_t offset;
+};
+
+/**
+ * State of a transfer between `transferBegin()` and `transferEnd()`, the curl callbacks refer to its members.
+ */
+struct Transfer
+{
+    std::string url;
+    WriteBuffer body;
+    UploadReader upload;
+    std::string filename;   // of the download file
+    curl_slist* headerList; // only used if the list has to be built for this transfer
+    curl::ResponseHeaders headers;
+    bool retryAfter;
+};
+
+// number of concurrent transfers while draining
+constexpr size_t drainConcurrency = 16;
+
+// how long after the drain deadline the responses which have to be popped are still set one at a time
+constexpr int64_t drainPopTimeout_ms = 1000;
+
+// per host latency samples of the hedge percentile, and the number needed before it's used
+constexpr size_t latencyWindow = 64;
+constexpr size_t latencyMinSamples = 16;
+
+// maximum sleep of the worker while connections are being warmed up, the warm-ups are progressed in between
+constexpr int warmUpPoll_us = 1000;
+
+/**
+ * DNS cache, connection cache and TLS session cache which are shared by all transfers of the curl thread, so that
+ * connections survive the cleanup of their easy handle. Also performs the warm-ups, see `curl::warmUp()`.
+ *
+ * Only used by the curl thread, hence no lock callbacks.
+ */
+class ConnectionPool
+{
+public:
+    ConnectionPool()
+        : m_share(nullptr), m_multi(nullptr), m_warming()
+    {}
+
+    virtual ~ConnectionPool() { cleanup(); }
+
+    /**
+     * @brief Has to be called after `curl_global_init()`.
+     */
+    void init()
+    {
+        m_share = curl_share_init();
+
+        if (m_share)
+        {
+            curl_share_setopt(m_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+            curl_share_setopt(m_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+            curl_share_setopt(m_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+        }
+    }
+
+    /**
+     * @brief Aborts the warm-ups and closes the connections, has to be called before `curl_global_cleanup()`.
+     */
+    void cleanup()
+    {
+        if (m_multi)
+        {
+            for (size_t i = 0; i < m_warming.size(); ++i)
+            {
+                curl_multi_remove_handle(m_multi, m_warming[i]);
+                curl_easy_cleanup(m_warming[i]);
+            }
+            m_warming.clear();
+
+            curl_multi_cleanup(m_multi);
+            m_multi = nullptr;
+        }
+
+        if (m_share) { curl_share_cleanup(m_share); }
+        m_share = nullptr;
+    }
+
+    CURLSH* share() const { return m_share; }
+
+    /**
+     * @brief Number of warm-ups in progress.
+     */
+    size_t warming() const { return m_warming.size(); }
+
+    void warmUp(const std::vector<std::string>& origins)
+    {
+        if (!m_multi) { m_multi = curl_multi_init(); }
+        if (!m_multi) { return; }
+
+        for (size_t i = 0; i < origins.size(); ++i)
+        {
+            CURL* const curl = curl_easy_init();
+            if (!curl) { continue; }
+
+            const std::string url = ((origins[i].find("://") == std::string::npos) ? ("https://" + origins[i]) : origins[i]);
+
+            // the URL string is copied, `CURLOPT_CONNECT_ONLY` is not used because such connections are not reused
+            curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+            curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+            curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 10L);
+            curl_easy_setopt(curl, CURLOPT_TIMEOUT, 20L);
+            if (m_share) { curl_easy_setopt(curl, CURLOPT_SHARE, m_share); }
+
+            if (curl_multi_add_handle(m_multi, curl) == CURLM_OK) { m_warming.push_back(curl); }
+            else { curl_easy_cleanup(curl); }
+        }
+    }
+
+    /**
+     * @brief Progresses the warm-ups, does not block.
+     *
+     * @return Number of warm-ups in progress
+     */
+    size_t perform()
+    {
+        if (m_warming.empty()) { return 0; }
+
+        int running = 0;
+        curl_multi_perform(m_multi, &running);
+
+        int nMsgs;
+        const CURLMsg* msg;
+
+        while ((msg = curl_multi_info_read(m_multi, &nMsgs)) != nullptr)
+        {
+            if (msg->msg != CURLMSG_DONE) { continue; }
+
+            CURL* const curl = msg->easy_handle;
+            const auto it = std::find(m_warming.begin(), m_warming.end(), curl);
+            if (it != m_warming.end()) { m_warming.erase(it); }
+
+            // the connection stays in the shared cache
+            curl_multi_remove_handle(m_multi, curl);
+            curl_easy_cleanup(curl);
+        }
+
+        return m_warming.size();
+    }
+
+private:
+    CURLSH* m_share;
+    CURLM* m_multi; // of the warm-ups
+    std::vector<CURL*> m_warming;
+};
+
+ConnectionPool& connectionPool()
+{
+    static ConnectionPool pool;
+    return pool;
+}
+
 enum STATE
 {
     S_init = 0,
@@ -144,16 +383,87 @@ enum STATE
     S_idle,
     S_request,
     S_awaitResponsePop,
+    S_drain,
 
     S__end_
 };
 
+const char* stateName(int state)
+{
+    const char* name = "?";
+
+    switch (state)
+    {
+    case S_init:
+        name = "S_init";
+        break;
+
+    case S_boot:
+        name = "S_boot";
+        break;
+
+    case S_shutdown:
+        name = "S_shutdown";
+        break;
+
+    case S_halted:
+        name = "S_halted";
+        break;
+
+    case S_idle:
+        name = "S_idle";
+        break;
+
+    case S_request:
+        name = "S_request";
+        break;
+
+    case S_awaitResponsePop:
+        name = "S_awaitResponsePop";
+        break;
+
+    case S_drain:
+        name = "S_drain";
+        break;
+    }
+
+    return name;
+}
+
+/**
+ * Maximum number of IDs a submission shard takes at once and keeps.
+ */
+constexpr size_t shardIdBatch = 8;
+
+/**
+ * Index of the calling thread, assigned on the first call in the order the threads call it.
+ */
+size_t producerIndex()
+{
+    static std::atomic<size_t> count(0);
+    thread_local const size_t index = count.fetch_add(1, std::memory_order_relaxed);
+    return index;
+}
+
 } // namespace
 
 
 
-static curl::Response perform(CURL* curl, const curl::ThreadSharedData::Request& request);
+static curl::Response perform(CURL* curl, const curl::ThreadSharedData::Request& request, long* retryAfter_s);
+static bool hedgeable(const curl::ThreadSharedData::Request& request);
+static curl::Response performHedged(const curl::ThreadSharedData::Request& request, const std::string& host, long delay_ms, long* retryAfter_s);
+static int transferBegin(CURL* curl, const curl::ThreadSharedData::Request& request, Transfer* transfer);
+static curl::Response transferEnd(CURL* curl, const curl::ThreadSharedData::Request& request, Transfer* transfer, CURLcode curlCode, long* retryAfter_s);
+static void drain(int64_t deadline_ms, std::deque<curl::Completion>& pending);
 static size_t transfer_write(char* p, size_t size, size_t nmemb, void* pClientData);
+static FILE* openDownloadFile(const std::string& name, std::string* filename);
+static size_t transfer_read(char* p, size_t size, size_t nitems, void* pClientData);
+static bool openUpload(const curl::UploadSource& source, UploadReader* reader, int64_t* size);
+static size_t transfer_header(char* p, size_t size, size_t nmemb, void* pClientData);
+static long parseRetryAfter(const curl::StringView& value);
+static long retryDelay(const curl::ThreadSharedData::Request& request, const curl::Response& response, long retryAfter_s);
+static void traceTransfer(CURL* curl, const curl::QueueId& queueId, int64_t tStart_ns);
+static long totalTime_ms(CURL* curl);
 
 
 
@@ -162,8 +472,22 @@ curl::ThreadSharedData curl::sharedData; // implicitly calls the default constru
 void curl::thread()
 {
     int state = S_init;
-    int threadSleep_us = 500;
+    int threadSleep_us = 0;
     curl::ThreadSharedData::Request request;
+    ConnectionPool& pool = connectionPool();
+    std::deque<curl::Completion> fanOut; // responses of the other requests of a batch, which have not been set yet
+
+    // sets the response, the responses of the other requests of a batch are set later on
+    const auto complete = [&fanOut](const curl::QueueId& id, const curl::Response& res) {
+        const std::vector<curl::QueueId> members = sharedData.takeBatchMembers(id);
+        for (size_t i = 0; i < members.size(); ++i) { fanOut.push_back(curl::Completion(members[i], res)); }
+
+        curl::trace::record(curl::trace::Event::done, id);
+        return sharedData.setResponse(res, id);
+    };
+
+    int tracedState = state;
+    int64_t tracedStateBegin = curl::trace::now();
 
     while (!sharedData.doTerminate())
     {
@@ -180,6 +504,7 @@ void curl::thread()
 
             if (curl_res == CURLE_OK)
             {
+                pool.init();
                 sharedData.setBooted(true);
                 state = S_idle;
             }
@@ -192,7 +517,11 @@ void curl::thread()
         break;
 
         case S_shutdown:
-            if (sharedData.booted()) { curl_global_cleanup(); }
+            if (sharedData.booted())
+            {
+                pool.cleanup();
+                curl_global_cleanup();
+            }
             sharedData.setBooted(false);
             state = S_halted;
             break;
@@ -204,38 +533,109 @@ void curl::thread()
 
 
         case S_idle:
+            if (!fanOut.empty())
+            {
+                // until one has to be popped
+                while (!fanOut.empty() && (state == S_idle))
+                {
+                    const curl::Completion c = fanOut.front();
+                    fanOut.pop_front();
 
-            request = sharedData.popRequest();
+                    curl::trace::record(curl::trace::Event::done, c.queueId());
+                    if (sharedData.setResponse(c.response(), c.queueId())) { state = S_awaitResponsePop; }
+                }
 
-            if (request.queueId().isValid())
-            {
-                state = S_request;
                 threadSleep_us = 200;
             }
-            else { threadSleep_us = 50 * 1000; }
+            else if (sharedData.doShutdown()) { state = ((sharedData.drainDeadline() >= 0) ? S_drain : S_shutdown); }
+            else
+            {
+                const std::vector<std::string> origins = sharedData.takeWarmUp();
+                if (!origins.empty()) { pool.warmUp(origins); }
 
-            if (sharedData.doShutdown()) { state = S_shutdown; }
+                // shed requests are completed first, so that their owners find out promptly
+                const curl::QueueId shedId = sharedData.popShed();
 
+                if (shedId.isValid())
+                {
+                    state = (complete(shedId, curl::Response(curl::Response::E_SHED, -1, "")) ? S_awaitResponsePop : S_idle);
+                    threadSleep_us = 200;
+                }
+                else
+                {
+                    sharedData.popRequest(request);
+
+                    if (request.queueId().isValid())
+                    {
+                        curl::trace::record(curl::trace::Event::dispatched, request.queueId());
+                        state = S_request;
+                        threadSleep_us = 0;
+                    }
+                    else
+                    {
+                        threadSleep_us = 50 * 1000;
+
+                        const long timer_ms = sharedData.timeToNextTimer();
+                        if ((timer_ms >= 0) && (timer_ms < 50)) { threadSleep_us = (int)timer_ms * 1000; }
+                    }
+                }
+            }
             break;
 
         case S_request:
         {
             curl::Response response = curl::Response(-1, -1, "curl_easy_init() failed");
+            long retryAfter_s = -1;
 
-            CURL* curl = curl_easy_init();
-            if (curl)
+            const std::string host = curl::util::urlHost(request.url());
+
+            if (!sharedData.circuitAllow(host)) { response = curl::Response(curl::Response::E_CIRCUIT_OPEN, -1, ""); }
+            else
             {
-                response = perform(curl, request);
-                curl_easy_cleanup(curl);
+                const long hedgeDelay_ms = (hedgeable(request) ? sharedData.hedgeDelay(host, request.hedgePolicy()) : -1);
+
+                if (hedgeDelay_ms >= 0) { response = performHedged(request, host, hedgeDelay_ms, &retryAfter_s); }
+                else
+                {
+                    CURL* curl = curl_easy_init();
+                    if (curl)
+                    {
+                        const int64_t tStart = curl::trace::now();
+                        response = perform(curl, request, &retryAfter_s);
+                        traceTransfer(curl, request.queueId(), tStart);
+                        sharedData.reportLatency(host, (response.curlOk() ? totalTime_ms(curl) : -1));
+                        curl_easy_cleanup(curl);
+                    }
+                }
+
+                sharedData.circuitReport(host, (!response.curlOk() || (response.httpCode() >= 500)));
             }
 
-            sharedData.setResponse(response, request.queueId());
-            state = S_awaitResponsePop;
+            request.incAttempt();
+            const long delay_ms = retryDelay(request, response, retryAfter_s);
+
+            threadSleep_us = 200;
+
+            if (delay_ms >= 0)
+            {
+                if (sharedData.delayRequest(request, delay_ms)) { curl::trace::record(curl::trace::Event::retry, request.queueId()); }
+                state = S_idle;
+            }
+            else { state = (complete(request.queueId(), response) ? S_awaitResponsePop : S_idle); }
         }
         break;
 
         case S_awaitResponsePop:
             if (!sharedData.getResponseQueueId().isValid()) { state = S_idle; }
+            else if (sharedData.doShutdown() && (sharedData.drainDeadline() >= 0) && (curl::util::steadyTime_ms() >= sharedData.drainDeadline()))
+            {
+                state = S_drain;
+            }
+            break;
+
+        case S_drain:
+            drain(sharedData.drainDeadline(), fanOut);
+            state = S_shutdown;
             break;
 
         default:
@@ -243,7 +643,19 @@ void curl::thread()
             break;
         }
 
-        curl::util::sleep(threadSleep_us);
+        if (state != tracedState)
+        {
+            const int64_t t = curl::trace::now();
+            curl::trace::record(curl::trace::Event::state, request.queueId(), tracedStateBegin, t - tracedStateBegin, stateName(tracedState));
+            tracedState = state;
+            tracedStateBegin = t;
+        }
+
+        int sleep_us = threadSleep_us;
+        if (((state == S_idle) || (state == S_awaitResponsePop)) && (pool.perform() > 0) && (sleep_us > warmUpPoll_us)) { sleep_us = warmUpPoll_us; }
+
+        // returns early if there is new work
+        sharedData.waitForWork(sleep_us);
 
     } // while !terminate
 
@@ -252,339 +664,3534 @@ void curl::thread()
 
 
 
-curl::Response perform(CURL* curl, const curl::ThreadSharedData::Request& request)
+/**
+ * @param [out] retryAfter_s Set to the value of the `Retry-After` response header if the retry policy of the request
+ * honours it, otherwise left untouched
+ */
+curl::Response perform(CURL* curl, const curl::ThreadSharedData::Request& request, long* retryAfter_s)
 {
-    curl_easy_setopt(curl, CURLOPT_URL, request.url().c_str());
-    curl_easy_setopt(curl, CURLOPT_USERAGENT, request.userAgent().c_str());
+    Transfer transfer;
 
-    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, request.connectTimeout());
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT, request.totalTimeout());
+    const int err = transferBegin(curl, request, &transfer);
+    if (err != CURLE_OK) { return curl::Response(err, -1, ""); }
 
-    curl_slist* headerList = nullptr;
+    const CURLcode curlCode = curl_easy_perform(curl);
 
-    if (!request.header().empty())
-    {
-        for (size_t i = 0; i < request.header().size(); ++i)
-        {
-            const auto& tmp = request.header()[i];
-            if (!tmp.empty())
-            {
-                // the src string is copied, and thus could be freed after this call
-                headerList = curl_slist_append(headerList, tmp.curlStr());
-            }
-        }
+    return transferEnd(curl, request, &transfer, curlCode, retryAfter_s);
+}
 
-        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headerList);
-    }
+bool hedgeable(const curl::ThreadSharedData::Request& request)
+{
+    // two transfers can't write the same download file
+    return (request.hedgePolicy().enabled() && ((request.method() == curl::Method::GET) || (request.method() == curl::Method::HEAD)) && !request.download());
+}
 
-    switch (request.method())
+/**
+ * Performs the request, and a duplicate if the request has not completed within `delay_ms` and the hedge limit allows
+ * it. The first successful response wins, the other transfer is aborted.
+ *
+ * @param [out] retryAfter_s See `perform()`
+ */
+curl::Response performHedged(const curl::ThreadSharedData::Request& request, const std::string& host, long delay_ms, long* retryAfter_s)
+{
+    struct Attempt
     {
-    case curl::Method::GET:
-        (void)0; // nop, ignoring body of GET request
-        break;
+        CURL* curl;
+        Transfer transfer;
+        int64_t tStart;
+        bool done;
+        CURLcode curlCode;
+    };
 
-    case curl::Method::POST:
-        curl_easy_setopt(curl, CURLOPT_POST, 1L);
-        if (!request.body().empty())
+    Attempt attempts[2] = {};
+    int started = 0;
+    int winner = -1;
+    bool hedgeDenied = false;
+
+    CURLM* const multi = curl_multi_init();
+    if (!multi) { return curl::Response(-1, -1, "curl_multi_init() failed"); }
+
+    const auto start = [&](Attempt& a) {
+        a.curl = curl_easy_init();
+        if (!a.curl) { return (int)CURLE_FAILED_INIT; }
+
+        a.tStart = curl::trace::now();
+
+        int err = transferBegin(a.curl, request, &(a.transfer));
+        if ((err == CURLE_OK) && (curl_multi_add_handle(multi, a.curl) != CURLM_OK))
         {
-            // does not copy the data, the memory pointed to has to stay allocated until the transfer finishes
-            curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request.body().c_str());
+            long tmp = -1;
+            (void)transferEnd(a.curl, request, &(a.transfer), CURLE_FAILED_INIT, &tmp);
+            err = CURLE_FAILED_INIT;
         }
-        break;
-    }
-
-    std::string resBody;
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, transfer_write);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &resBody);
 
-    const CURLcode curlCode = curl_easy_perform(curl);
+        if (err != CURLE_OK)
+        {
+            curl_easy_cleanup(a.curl);
+            a.curl = nullptr;
+        }
 
-    long httpCode;
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpCode);
+        return err;
+    };
 
-    curl_slist_free_all(headerList);
+    const int err = start(attempts[0]);
+    if (err != CURLE_OK)
+    {
+        curl_multi_cleanup(multi);
+        return curl::Response(err, -1, "");
+    }
 
-    return curl::Response((int)curlCode, (int)httpCode, resBody);
-}
+    started = 1;
+    const int64_t t0 = curl::util::steadyTime_ms();
 
-size_t transfer_write(char* p, size_t size, size_t nmemb, void* pClientData)
-{
-    size_t effSize = size * nmemb;
-    for (size_t i = 0; i < effSize; ++i) { static_cast<std::string*>(pClientData)->push_back(*(p + i)); }
-    return effSize;
-}
+    while (winner < 0)
+    {
+        int running = 0;
+        curl_multi_perform(multi, &running);
 
+        int nMsgs;
+        const CURLMsg* msg;
 
+        while ((msg = curl_multi_info_read(multi, &nMsgs)) != nullptr)
+        {
+            if (msg->msg != CURLMSG_DONE) { continue; }
 
-//======================================================================================================================
-// curl.h implementation
+            for (int i = 0; i < started; ++i)
+            {
+                if (attempts[i].curl == msg->easy_handle)
+                {
+                    attempts[i].done = true;
+                    attempts[i].curlCode = msg->data.result;
+                    curl_multi_remove_handle(multi, attempts[i].curl);
 
+                    long httpCode = 0;
+                    curl_easy_getinfo(attempts[i].curl, CURLINFO_RESPONSE_CODE, &httpCode);
+                    if ((winner < 0) && (attempts[i].curlCode == CURLE_OK) && (httpCode < 500)) { winner = i; }
+                }
+            }
+        }
 
+        const bool hedgePending = ((started == 1) && !hedgeDenied);
 
-#ifdef CURLTHREAD_CONFIG_DEBUG_print_queueId_vector
-#include <iostream>
-using std::cout;
-using std::endl;
-#endif
+        if ((winner < 0) && hedgePending && !attempts[0].done && ((curl::util::steadyTime_ms() - t0) >= delay_ms))
+        {
+            if (curl::sharedData.hedgeAllow() && (start(attempts[1]) == CURLE_OK)) { started = 2; }
+            else { hedgeDenied = true; }
 
+            continue;
+        }
 
+        // all attempts failed
+        if ((winner < 0) && attempts[0].done && (attempts[1].done || (started == 1))) { winner = 0; }
 
-curl::QueueId curl::ThreadSharedData::queueRequest(const curl::Request& req, const curl::Priority& priority)
-{
-    lock_guard lg(m_mtx);
+        if (winner < 0)
+        {
+            long timeout_ms = 50;
+            const int64_t hedgeIn_ms = t0 + delay_ms - curl::util::steadyTime_ms();
+            if (hedgePending && (hedgeIn_ms < timeout_ms)) { timeout_ms = (hedgeIn_ms > 0 ? (long)hedgeIn_ms : 0); }
 
-    curl::QueueId id = m_getNewQueueId();
+            curl_multi_poll(multi, nullptr, 0, (int)timeout_ms, nullptr);
+        }
+    }
 
-    DEBUG_print_queueId_vector_before();
+    Attempt& w = attempts[winner];
+    const curl::Response response = transferEnd(w.curl, request, &(w.transfer), w.curlCode, retryAfter_s);
+    traceTransfer(w.curl, request.queueId(), w.tStart);
+    curl::sharedData.reportLatency(host, (response.curlOk() ? totalTime_ms(w.curl) : -1));
+    if (winner == 1) { curl::sharedData.hedgeWon(); }
 
-    if (id.isValid())
+    // the loser is aborted, or has failed
+    for (int i = 0; i < started; ++i)
     {
-        const ThreadSharedData::Request tmp(req, id);
+        Attempt& a = attempts[i];
 
-        try
+        if (i != winner)
         {
-            m_queueId.push_back(id);
+            long tmp = -1;
+            if (!a.done) { curl_multi_remove_handle(multi, a.curl); }
+            (void)transferEnd(a.curl, request, &(a.transfer), (a.done ? a.curlCode : CURLE_ABORTED_BY_CALLBACK), &tmp);
+        }
+
+        curl_easy_cleanup(a.curl);
+    }
+
+    curl_multi_cleanup(multi);
+
+    return response;
+}
+
+/**
+ * Sets up the easy handle. `request` and `transfer` have to stay at the same address until `transferEnd()` has been
+ * called.
+ *
+ * @return `CURLE_OK`, otherwise the transfer is not set up and `transferEnd()` must not be called
+ */
+int transferBegin(CURL* curl, const curl::ThreadSharedData::Request& request, Transfer* transfer)
+{
+    transfer->url = request.url(); // has to stay allocated until the transfer finishes
+    curl_easy_setopt(curl, CURLOPT_URL, transfer->url.c_str());
+
+    CURLSH* const share = connectionPool().share();
+    if (share) { curl_easy_setopt(curl, CURLOPT_SHARE, share); }
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, request.userAgent().c_str());
+
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, request.connectTimeout());
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, request.totalTimeout());
+
+    WriteBuffer& resBody = transfer->body;
+    resBody.fp = nullptr;
+    resBody.size = 0;
+    resBody.maxSize = request.maxResponseSize();
+    resBody.exceeded = false;
+    resBody.writeError = false;
+
+    const curl::UploadSource* const upload = request.upload().get();
+    UploadReader& uploadReader = transfer->upload;
+    uploadReader.source = nullptr;
+    uploadReader.fp = nullptr;
+    uploadReader.offset = 0;
+    int64_t uploadSize = -1;
+
+    transfer->headerList = nullptr;
+
+    if (upload && !openUpload(*upload, &uploadReader, &uploadSize)) { return curl::Response::E_FILE; }
+
+    if (request.download())
+    {
+        resBody.fp = openDownloadFile(request.downloadFile(), &(transfer->filename));
+
+        if (!resBody.fp)
+        {
+            if (upload && uploadReader.fp) { std::fclose(uploadReader.fp); }
+            return curl::Response::E_FILE;
+        }
+    }
+
+    curl_slist*& headerList = transfer->headerList;
+    const curl::HeaderSet* const headerSet = request.headerSet().get();
+
+    if (headerSet && headerSet->curlList() && request.header().empty())
+    {
+        // prebuilt list, stays allocated as long as `request` exists
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headerSet->curlList());
+    }
+    else if (!request.header().empty() || (headerSet && (headerSet->size() > 0)))
+    {
+        if (headerSet)
+        {
+            for (size_t i = 0; i < headerSet->size(); ++i)
+            {
+                // the src string is copied, and thus could be freed after this call
+                if (!(*headerSet)[i].empty()) { headerList = curl_slist_append(headerList, (*headerSet)[i].curlStr()); }
+            }
+        }
+
+        for (size_t i = 0; i < request.header().size(); ++i)
+        {
+            const auto& tmp = request.header()[i];
+            if (!tmp.empty())
+            {
+                // the src string is copied, and thus could be freed after this call
+                headerList = curl_slist_append(headerList, tmp.curlStr());
+            }
+        }
+
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headerList);
+    }
+
+    switch (request.method())
+    {
+    case curl::Method::GET:
+        (void)0; // nop, ignoring body of GET request
+        break;
+
+    case curl::Method::HEAD:
+        curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+        break;
+
+    case curl::Method::POST:
+        curl_easy_setopt(curl, CURLOPT_POST, 1L);
+        if (upload)
+        {
+            // chunked transfer encoding if the size is -1
+            curl_easy_setopt(curl, CURLOPT_READFUNCTION, transfer_read);
+            curl_easy_setopt(curl, CURLOPT_READDATA, &uploadReader);
+            curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)uploadSize);
+        }
+        else
+        {
+            // does not copy the data, the memory pointed to has to stay allocated until the transfer finishes
+            curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)request.body().size());
+            curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request.body().c_str());
+        }
+        break;
+
+    case curl::Method::PUT:
+    case curl::Method::PATCH:
+    case curl::Method::DELETE:
+        if (upload)
+        {
+            curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
+            curl_easy_setopt(curl, CURLOPT_READFUNCTION, transfer_read);
+            curl_easy_setopt(curl, CURLOPT_READDATA, &uploadReader);
+            curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, (curl_off_t)uploadSize);
+        }
+        else if (!request.body().empty() || (request.method() != curl::Method::DELETE))
+        {
+            // PUT and PATCH without body send `Content-Length: 0`
+            curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)request.body().size());
+            curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request.body().c_str());
+        }
+
+        // the string is copied
+        curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, curl::toString(request.method()).c_str());
+        break;
+    }
+
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, transfer_write);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &resBody);
+
+    // aborts early if the size is announced, the write callback catches the rest
+    if (resBody.maxSize > 0) { curl_easy_setopt(curl, CURLOPT_MAXFILESIZE_LARGE, (curl_off_t)resBody.maxSize); }
+
+    transfer->retryAfter = (request.retryPolicy().enabled() && request.retryPolicy().retryAfter());
+
+    if (request.captureHeaders() || transfer->retryAfter)
+    {
+        curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, transfer_header);
+        curl_easy_setopt(curl, CURLOPT_HEADERDATA, &(transfer->headers));
+    }
+
+    return CURLE_OK;
+}
+
+/**
+ * Cleans up after the transfer has finished and builds the response.
+ *
+ * @param [out] retryAfter_s See `perform()`
+ */
+curl::Response transferEnd(CURL* curl, const curl::ThreadSharedData::Request& request, Transfer* transfer, CURLcode curlCode, long* retryAfter_s)
+{
+    WriteBuffer& resBody = transfer->body;
+    const std::string& filename = transfer->filename;
+
+    if (resBody.exceeded)
+    {
+        curlCode = CURLE_FILESIZE_EXCEEDED;
+        resBody.data = std::string();
+    }
+
+    int fileError = CURLE_OK;
+    curl::MappedFilePtr file;
+
+    if (resBody.fp)
+    {
+        const bool temporary = request.downloadFile().empty();
+
+        if ((std::fclose(resBody.fp) != 0) || resBody.writeError) { fileError = curl::Response::E_FILE; }
+
+        if ((curlCode == CURLE_OK) && (fileError == CURLE_OK))
+        {
+            file = std::make_shared<const curl::MappedFile>(filename, temporary);
+            if (!file->isValid())
+            {
+                fileError = curl::Response::E_FILE;
+                file.reset();
+            }
+        }
+        else if (temporary) { std::remove(filename.c_str()); }
+    }
+
+    long httpCode;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpCode);
+
+    curl_slist_free_all(transfer->headerList);
+    transfer->headerList = nullptr;
+
+    if (transfer->upload.fp) { std::fclose(transfer->upload.fp); }
+    transfer->upload.fp = nullptr;
+
+    if (transfer->retryAfter)
+    {
+        const long tmp = parseRetryAfter(transfer->headers.find("Retry-After"));
+        if (tmp >= 0) { *retryAfter_s = tmp; }
+    }
+
+    const int code = ((fileError != CURLE_OK) ? fileError : (int)curlCode);
+    curl::Response response = (request.captureHeaders() ? curl::Response(code, (int)httpCode, resBody.data, transfer->headers)
+                                                        : curl::Response(code, (int)httpCode, resBody.data));
+    response.setFile(file);
+
+    return response;
+}
+
+/**
+ * Performs the queued requests concurrently until the queues are empty or the deadline has passed. The requests which
+ * are still queued or in flight by then fail with `curl::Response::E_SHUTDOWN`. The responses which have to be popped
+ * are set one at a time until `drainPopTimeout_ms` after that, the remaining ones are discarded and their IDs released.
+ *
+ * @param pending Responses which have not been set yet
+ */
+void drain(int64_t deadline_ms, std::deque<curl::Completion>& pending)
+{
+    struct DrainTransfer
+    {
+        curl::ThreadSharedData::Request request;
+        CURL* curl;
+        Transfer transfer;
+        std::string host;
+        int64_t tStart;
+    };
+
+    CURLM* const multi = curl_multi_init();
+    std::list<DrainTransfer> active; // the elements must not move, curl refers to them
+    std::deque<curl::Completion> undelivered; // responses which have to be popped, the slot takes one at a time
+
+    const auto deliver = [&undelivered](const curl::QueueId& id, const curl::Response& res) {
+        std::vector<curl::QueueId> ids = curl::sharedData.takeBatchMembers(id);
+        ids.insert(ids.begin(), id);
+
+        for (size_t i = 0; i < ids.size(); ++i)
+        {
+            curl::trace::record(curl::trace::Event::done, ids[i]);
+
+            if (curl::sharedData.deliversToSlot(ids[i]) && (!undelivered.empty() || curl::sharedData.getResponseQueueId().isValid()))
+            {
+                undelivered.push_back(curl::Completion(ids[i], res));
+            }
+            else { curl::sharedData.setResponse(res, ids[i]); }
+        }
+    };
+
+    const auto finish = [&deliver, deadline_ms](DrainTransfer& t, CURLcode curlCode) {
+        long retryAfter_s = -1;
+        const curl::Response response = transferEnd(t.curl, t.request, &(t.transfer), curlCode, &retryAfter_s);
+        traceTransfer(t.curl, t.request.queueId(), t.tStart);
+        curl_easy_cleanup(t.curl);
+
+        curl::sharedData.circuitReport(t.host, (!response.curlOk() || (response.httpCode() >= 500)));
+
+        t.request.incAttempt();
+        const long delay_ms = retryDelay(t.request, response, retryAfter_s);
+
+        if ((delay_ms >= 0) && ((curl::util::steadyTime_ms() + delay_ms) < deadline_ms))
+        {
+            if (curl::sharedData.delayRequest(t.request, delay_ms)) { curl::trace::record(curl::trace::Event::retry, t.request.queueId()); }
+        }
+        else { deliver(t.request.queueId(), response); }
+    };
+
+    for (size_t i = 0; i < pending.size(); ++i) { deliver(pending[i].queueId(), pending[i].response()); }
+    pending.clear();
+
+    // the collected batches are sent right away
+    curl::sharedData.flushBatches();
+
+    while (multi && (curl::util::steadyTime_ms() < deadline_ms))
+    {
+        if (!undelivered.empty() && !curl::sharedData.getResponseQueueId().isValid())
+        {
+            curl::sharedData.setResponse(undelivered.front().response(), undelivered.front().queueId());
+            undelivered.pop_front();
+        }
+
+        while (active.size() < drainConcurrency)
+        {
+            const curl::QueueId shedId = curl::sharedData.popShed();
+            if (shedId.isValid())
+            {
+                deliver(shedId, curl::Response(curl::Response::E_SHED, -1, ""));
+                continue;
+            }
+
+            const curl::ThreadSharedData::Request request = curl::sharedData.popRequest();
+            if (!request.queueId().isValid()) { break; }
+
+            curl::trace::record(curl::trace::Event::dispatched, request.queueId());
+
+            const std::string host = curl::util::urlHost(request.url());
+
+            if (!curl::sharedData.circuitAllow(host))
+            {
+                deliver(request.queueId(), curl::Response(curl::Response::E_CIRCUIT_OPEN, -1, ""));
+                continue;
+            }
+
+            CURL* const curl = curl_easy_init();
+
+            if (!curl)
+            {
+                curl::sharedData.circuitReport(host, true);
+                deliver(request.queueId(), curl::Response(-1, -1, "curl_easy_init() failed"));
+                continue;
+            }
+
+            active.push_back(DrainTransfer());
+            DrainTransfer& t = active.back();
+            t.request = request;
+            t.curl = curl;
+            t.host = host;
+            t.tStart = curl::trace::now();
+
+            const int err = transferBegin(curl, t.request, &(t.transfer));
+
+            if (err != CURLE_OK)
+            {
+                curl_easy_cleanup(curl);
+                deliver(request.queueId(), curl::Response(err, -1, ""));
+                active.pop_back();
+            }
+            else if (curl_multi_add_handle(multi, curl) != CURLM_OK)
+            {
+                finish(t, CURLE_FAILED_INIT);
+                active.pop_back();
+            }
+        }
+
+        if (active.empty() && undelivered.empty() &&
+            ((curl::sharedData.getQNormalSize() + curl::sharedData.getQHighSize() + curl::sharedData.getQMaxSize() + curl::sharedData.getQDelayedSize()) == 0))
+        {
+            break;
+        }
+
+        int running = 0;
+        curl_multi_perform(multi, &running);
+
+        int nMsgs;
+        const CURLMsg* msg;
+
+        while ((msg = curl_multi_info_read(multi, &nMsgs)) != nullptr)
+        {
+            if (msg->msg != CURLMSG_DONE) { continue; }
+
+            for (auto it = active.begin(); it != active.end(); ++it)
+            {
+                if (it->curl == msg->easy_handle)
+                {
+                    const CURLcode curlCode = msg->data.result;
+                    curl_multi_remove_handle(multi, it->curl);
+                    finish(*it, curlCode);
+                    active.erase(it);
+                    break;
+                }
+            }
+        }
+
+        // waits for socket activity, a due timer, the response slot or the deadline
+        long timeout_ms = (undelivered.empty() ? 50 : 5);
+        const long timer_ms = curl::sharedData.timeToNextTimer();
+        const int64_t remaining_ms = deadline_ms - curl::util::steadyTime_ms();
+        if ((timer_ms >= 0) && (timer_ms < timeout_ms)) { timeout_ms = timer_ms; }
+        if (remaining_ms < timeout_ms) { timeout_ms = (remaining_ms > 0 ? (long)remaining_ms : 0); }
+
+        curl_multi_poll(multi, nullptr, 0, (int)timeout_ms, nullptr);
+    }
+
+    // the deadline has passed or everything has been delivered
+    for (auto it = active.begin(); it != active.end(); ++it)
+    {
+        long retryAfter_s = -1;
+        curl_multi_remove_handle(multi, it->curl);
+        (void)transferEnd(it->curl, it->request, &(it->transfer), CURLE_ABORTED_BY_CALLBACK, &retryAfter_s);
+        curl_easy_cleanup(it->curl);
+        deliver(it->request.queueId(), curl::Response(curl::Response::E_SHUTDOWN, -1, ""));
+    }
+    active.clear();
+
+    for (curl::QueueId id = curl::sharedData.popShed(); id.isValid(); id = curl::sharedData.popShed())
+    {
+        deliver(id, curl::Response(curl::Response::E_SHED, -1, ""));
+    }
+
+    const std::vector<curl::ThreadSharedData::Request> remaining = curl::sharedData.takeRemaining();
+    for (size_t i = 0; i < remaining.size(); ++i) { deliver(remaining[i].queueId(), curl::Response(curl::Response::E_SHUTDOWN, -1, "")); }
+
+    // the responses which have to be popped get a second timeout, the ones which aren't set by then are discarded
+    const int64_t popDeadline_ms = curl::util::steadyTime_ms() + drainPopTimeout_ms;
+    while (!undelivered.empty() && (curl::util::steadyTime_ms() < popDeadline_ms))
+    {
+        if (!curl::sharedData.getResponseQueueId().isValid())
+        {
+            curl::sharedData.setResponse(undelivered.front().response(), undelivered.front().queueId());
+            undelivered.pop_front();
+        }
+        else { curl::sharedData.waitForWork(5 * 1000); }
+    }
+
+    curl::sharedData.releaseCompletions(std::vector<curl::Completion>(undelivered.begin(), undelivered.end()));
+
+    if (multi) { curl_multi_cleanup(multi); }
+}
+
+size_t transfer_write(char* p, size_t size, size_t nmemb, void* pClientData)
+{
+    WriteBuffer* const buffer = static_cast<WriteBuffer*>(pClientData);
+    const size_t effSize = size * nmemb;
+
+    if ((buffer->maxSize > 0) && ((buffer->size + (int64_t)effSize) > buffer->maxSize))
+    {
+        buffer->exceeded = true;
+        return 0; // aborts the transfer
+    }
+
+    size_t written = effSize;
+
+    if (buffer->fp)
+    {
+        written = std::fwrite(p, 1, effSize, buffer->fp);
+        if (written != effSize) { buffer->writeError = true; }
+    }
+    else { buffer->data.append(p, effSize); }
+
+    buffer->size += (int64_t)written;
+
+    return written;
+}
+
+size_t transfer_read(char* p, size_t size, size_t nitems, void* pClientData)
+{
+    UploadReader* const reader = static_cast<UploadReader*>(pClientData);
+    const curl::UploadSource& source = *(reader->source);
+    const size_t bufferSize = size * nitems;
+    size_t n = 0;
+
+    switch (source.type())
+    {
+    case curl::UploadSource::Type::file:
+        n = std::fread(p, 1, bufferSize, reader->fp);
+        if ((n == 0) && std::ferror(reader->fp)) { n = CURL_READFUNC_ABORT; }
+        break;
+
+    case curl::UploadSource::Type::fd:
+    {
+#ifdef _WIN32
+        const int r = _read(source.fd(), p, (unsigned int)(bufferSize < INT32_MAX ? bufferSize : INT32_MAX));
+#else
+        const ssize_t r = read(source.fd(), p, bufferSize);
+#endif
+        n = ((r >= 0) ? (size_t)r : CURL_READFUNC_ABORT);
+    }
+    break;
+
+    case curl::UploadSource::Type::mapping:
+        if (source.file())
+        {
+            const size_t remaining = source.file()->size() - (size_t)reader->offset;
+            n = ((remaining < bufferSize) ? remaining : bufferSize);
+            std::memcpy(p, source.file()->data() + reader->offset, n);
+        }
+        break;
+
+    case curl::UploadSource::Type::function:
+        n = source.function()(p, bufferSize, reader->offset);
+        break;
+    }
+
+    if (n != CURL_READFUNC_ABORT) { reader->offset += (int64_t)n; }
+
+    return n;
+}
+
+/**
+ * Prepares the upload for an attempt, the body is read from the beginning.
+ *
+ * @param [out] size Size of the body, -1 if unknown
+ * @return `false` if the file could not be opened
+ */
+bool openUpload(const curl::UploadSource& source, UploadReader* reader, int64_t* size)
+{
+    reader->source = &source;
+    reader->fp = nullptr;
+    reader->offset = 0;
+    *size = source.size();
+
+    if (source.type() == curl::UploadSource::Type::file)
+    {
+        reader->fp = std::fopen(source.filename().c_str(), "rb");
+        if (!reader->fp) { return false; }
+
+        std::setvbuf(reader->fp, nullptr, _IOFBF, fileBufferSize);
+
+#ifdef _WIN32
+        if (_fseeki64(reader->fp, 0, SEEK_END) == 0) { *size = _ftelli64(reader->fp); }
+        _fseeki64(reader->fp, 0, SEEK_SET);
+#else
+        if (fseeko(reader->fp, 0, SEEK_END) == 0) { *size = (int64_t)ftello(reader->fp); }
+        fseeko(reader->fp, 0, SEEK_SET);
+#endif
+    }
+    else if (source.type() == curl::UploadSource::Type::fd)
+    {
+        // fails on pipes and sockets, they are read from the current position
+#ifdef _WIN32
+        (void)_lseeki64(source.fd(), 0, SEEK_SET);
+#else
+        (void)lseek(source.fd(), 0, SEEK_SET);
+#endif
+    }
+
+    return true;
+}
+
+/**
+ * Opens the file a response body is downloaded to. If `name` is empty a temporary file is created.
+ *
+ * @param [out] filename Name of the opened file
+ * @return The file opened for writing, or `nullptr` on failure
+ */
+FILE* openDownloadFile(const std::string& name, std::string* filename)
+{
+    FILE* fp = nullptr;
+
+    if (!name.empty())
+    {
+        *filename = name;
+        fp = std::fopen(name.c_str(), "wb");
+    }
+    else
+    {
+#ifdef _WIN32
+        char dir[MAX_PATH + 1];
+        char buffer[MAX_PATH + 1];
+        const DWORD n = GetTempPathA(sizeof(dir), dir);
+
+        if ((n > 0) && (n < sizeof(dir)) && (GetTempFileNameA(dir, "ctd", 0, buffer) != 0))
+        {
+            *filename = buffer;
+            fp = std::fopen(buffer, "wb");
+        }
+#else
+        const char* const dir = std::getenv("TMPDIR");
+        std::string tmp = std::string(((dir && *dir) ? dir : "/tmp")) + "/curl-thread-XXXXXX";
+
+        const int fd = mkstemp(&tmp[0]);
+        if (fd >= 0)
+        {
+            *filename = tmp;
+            fp = fdopen(fd, "wb");
+
+            if (!fp)
+            {
+                close(fd);
+                unlink(tmp.c_str());
+            }
+        }
+#endif
+    }
+
+    if (fp) { std::setvbuf(fp, nullptr, _IOFBF, fileBufferSize); }
+
+    return fp;
+}
+
+/**
+ * The header callback is called once per header line, the line is not null terminated.
+ */
+size_t transfer_header(char* p, size_t size, size_t nmemb, void* pClientData)
+{
+    const size_t effSize = size * nmemb;
+    static_cast<curl::ResponseHeaders*>(pClientData)->parseLine(p, effSize);
+    return effSize;
+}
+
+/**
+ * Parses the value of a `Retry-After` header, which is either delay-seconds or an HTTP-date.
+ *
+ * @return Delay in seconds, or -1 if the value is empty or invalid
+ */
+long parseRetryAfter(const curl::StringView& value)
+{
+    long retryAfter_s = -1;
+
+    if (!value.empty())
+    {
+        const std::string str = value.str();
+
+        if (str.find_first_not_of("0123456789") == std::string::npos) { retryAfter_s = std::strtol(str.c_str(), nullptr, 10); }
+        else
+        {
+            const time_t t = curl_getdate(str.c_str(), nullptr);
+            if (t >= 0)
+            {
+                const time_t diff = t - std::time(nullptr);
+                retryAfter_s = (diff > 0 ? (long)diff : 0);
+            }
+        }
+    }
+
+    return retryAfter_s;
+}
+
+/**
+ * @param request The request after the attempt
+ * @param retryAfter_s Value of the `Retry-After` header or -1 if there was none
+ * @return Delay in milliseconds before the next attempt, or -1 if the response is final
+ */
+long retryDelay(const curl::ThreadSharedData::Request& request, const curl::Response& response, long retryAfter_s)
+{
+    const curl::RetryPolicy& policy = request.retryPolicy();
+    long delay_ms = -1;
+
+    if (policy.enabled() && (request.attempt() < policy.maxAttempts()) && policy.retryable(response.curlCode(), response.httpCode()))
+    {
+        if (policy.retryAfter() && (retryAfter_s >= 0))
+        {
+            if (retryAfter_s <= (policy.maxDelay() / 1000)) { delay_ms = retryAfter_s * 1000; }
+        }
+        else { delay_ms = policy.delay(request.attempt()); }
+    }
+
+    return delay_ms;
+}
+
+/**
+ * Records the transfer phases. The curl timings are relative to the start of the transfer and each one includes the
+ * previous phases, see [`CURLINFO_NAMELOOKUP_TIME_T`](https://curl.se/libcurl/c/CURLINFO_NAMELOOKUP_TIME_T.html).
+ */
+void traceTransfer(CURL* curl, const curl::QueueId& queueId, int64_t tStart_ns)
+{
+    if (!curl::trace::enabled()) { return; }
+
+    curl_off_t tDns = 0, tConnect = 0, tTls = 0, tPre = 0, tFirstByte = 0, tTotal = 0; // [us]
+    curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &tDns);
+    curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &tConnect);
+    curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &tTls);
+    curl_easy_getinfo(curl, CURLINFO_PRETRANSFER_TIME_T, &tPre);
+    curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &tFirstByte);
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &tTotal);
+
+    auto span = [&](curl::trace::Event event, curl_off_t begin_us, curl_off_t end_us) {
+        if (end_us > begin_us) { curl::trace::record(event, queueId, tStart_ns + (int64_t)begin_us * 1000, (int64_t)(end_us - begin_us) * 1000); }
+    };
+
+    span(curl::trace::Event::dns, 0, tDns);
+    span(curl::trace::Event::connect, tDns, tConnect);
+    if (tTls > 0) { span(curl::trace::Event::tls, tConnect, tTls); } // 0 if there was no TLS handshake
+    span(curl::trace::Event::firstByte, tPre, tFirstByte);
+    span(curl::trace::Event::transfer, tFirstByte, tTotal);
+}
+
+long totalTime_ms(CURL* curl)
+{
+    curl_off_t t = 0; // [us]
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &t);
+    return (long)(t / 1000);
+}
+
+
+
+//======================================================================================================================
+// curl.h implementation
+
+
+
+void curl::DebugQueuePolicy::debugHook(const char* event, int id, const std::string& acquired)
+{
+    printf("\033[90mCURLTHREAD %s %i\n    queue IDs: [ %s ]\033[39m\n", event, id, acquired.c_str());
+}
+
+
+
+template <class Policy>
+void curl::BasicThreadSharedData<Policy>::shutdown()
+{
+    thread::ThreadCtl::shutdown();
+
+    lock_guard lg(m_mtx);
+    m_wakeWorker();
+}
+
+template <class Policy>
+void curl::BasicThreadSharedData<Policy>::shutdown(const std::chrono::milliseconds& drainTimeout)
+{
+    {
+        lock_guard lg(m_mtx);
+        m_drainDeadline_ms = curl::util::steadyTime_ms() + (drainTimeout.count() > 0 ? (int64_t)drainTimeout.count() : 0);
+    }
+
+    this->shutdown();
+}
+
+template <class Policy>
+void curl::BasicThreadSharedData<Policy>::warmUp(const std::vector<std::string>& origins)
+{
+    lock_guard lg(m_mtx);
+    m_warmUp.insert(m_warmUp.end(), origins.begin(), origins.end());
+    m_wakeWorker();
+}
+
+template <class Policy>
+curl::QueueId curl::BasicThreadSharedData<Policy>::queueRequest(const curl::Request& req, const curl::Priority& priority)
+{
+    if (m_shardLevels.load(std::memory_order_acquire) & (1u << (int)priority))
+    {
+        const curl::QueueId id = m_submit(req, priority);
+        if (id != QueueId::NONE) { return id; }
+    }
+
+    lock_guard lg(m_mtx);
+
+    const curl::QueueId id = m_queueRequest(req, priority);
+    if (id == QueueId::OVER_BUDGET) { ++m_stats.overBudget; }
+
+    return id;
+}
+
+template <class Policy>
+curl::QueueId curl::BasicThreadSharedData<Policy>::queueRequest(const curl::Request& req, const curl::Priority& priority,
+                                                                 const std::chrono::milliseconds& timeout)
+{
+    std::unique_lock<std::mutex> lock(m_mtx);
+
+    const auto until = std::chrono::steady_clock::now() + timeout;
+    const size_t bytes = req.body().size();
+    bool timedOut = false;
+
+    curl::QueueId id = m_queueRequest(req, priority);
+
+    while ((id == QueueId::OVER_BUDGET) && !timedOut && m_budgetFits(priority, bytes))
+    {
+        timedOut = (m_budgetCv.wait_until(lock, until) == std::cv_status::timeout);
+        id = m_queueRequest(req, priority);
+    }
+
+    if (id == QueueId::OVER_BUDGET) { ++m_stats.overBudget; }
+
+    return id;
+}
+
+template <class Policy>
+curl::QueueId curl::BasicThreadSharedData<Policy>::queueRequest(const curl::Request& req, const curl::Priority& priority,
+                                                                 const curl::CompletionHandler& handler)
+{
+    lock_guard lg(m_mtx);
+
+    curl::QueueId id = m_queueRequest(req, priority);
+    if (id == QueueId::OVER_BUDGET) { ++m_stats.overBudget; }
+
+    if (id.isValid())
+    {
+        try
+        {
+            BasicThreadSharedData::Slot& slot = m_slots[id];
+            slot.handler = handler;
+            slot.hasHandler = true;
+        }
+        catch (...)
+        {
+            m_unqueue(id, priority);
+            m_release(id);
+            id = QueueId::FAILED;
+        }
+    }
+
+    return id;
+}
+
+template <class Policy>
+curl::QueueId curl::BasicThreadSharedData<Policy>::queueRequest(const curl::Request& req, const curl::Priority& priority, const curl::Delivery& delivery)
+{
+    if (delivery == Delivery::popResponse) { return queueRequest(req, priority); }
+
+    curl::CompletionQueuePtr queue;
+
+    {
+        lock_guard lg(m_mtx);
+        queue = m_getDefaultQueue();
+    }
+
+    return queueRequest(req, priority, queue);
+}
+
+template <class Policy>
+curl::QueueId curl::BasicThreadSharedData<Policy>::queueRequest(const curl::Request& req, const curl::Priority& priority, const curl::CompletionQueuePtr& queue)
+{
+    if (!queue) { return QueueId::FAILED; }
+
+    lock_guard lg(m_mtx);
+
+    curl::QueueId id = m_queueRequest(req, priority);
+    if (id == QueueId::OVER_BUDGET) { ++m_stats.overBudget; }
+
+    if (id.isValid())
+    {
+        try
+        {
+            m_routes[id] = queue;
+        }
+        catch (...)
+        {
+            m_unqueue(id, priority);
+            m_routes.erase(id);
+            m_release(id);
+            id = QueueId::FAILED;
+        }
+    }
+
+    return id;
+}
+
+template <class Policy>
+bool curl::BasicThreadSharedData<Policy>::cancelRequest(const curl::QueueId& queueId)
+{
+    lock_guard lg(m_mtx);
+
+    m_drainShards();
+
+    if (!queueId.isValid() || (m_scheduled.find(queueId) != m_scheduled.end())) { return false; }
+    if (std::find(m_cancelled.begin(), m_cancelled.end(), queueId) != m_cancelled.end()) { return false; }
+    if (!m_slots.acquired(queueId)) { return false; }
+
+    m_slots[queueId].handler = nullptr;
+    m_slots[queueId].hasHandler = false;
+
+    const auto itRoute = m_routes.find(queueId);
+    if ((itRoute != m_routes.end()) && itRoute->second->remove(queueId))
+    {
+        m_routes.erase(itRoute);
+        m_release(queueId);
+        return true;
+    }
+
+    for (auto it = m_batchers.begin(); it != m_batchers.end(); ++it)
+    {
+        Batcher& b = it->second;
+
+        for (size_t i = 0; i < b.items.size(); ++i)
+        {
+            if (b.items[i].queueId() == queueId)
+            {
+                b.bytes -= b.items[i].body().size();
+                b.items.erase(b.items.begin() + i);
+
+                // the timer refers to the first item
+                if ((i == 0) && !b.items.empty()) { b.timerSeq = m_insertTimer(b.items[0].queueId(), b.due_ms); }
+
+                m_routes.erase(queueId);
+                m_release(queueId);
+                return true;
+            }
+        }
+    }
+
+    // a sent batch is performed for the other requests, only the response is discarded
+    bool batched = (m_batches.find(queueId) != m_batches.end());
+    for (auto it = m_batches.begin(); (it != m_batches.end()) && !batched; ++it)
+    {
+        batched = (std::find(it->second.begin(), it->second.end(), queueId) != it->second.end());
+    }
+
+    if (batched)
+    {
+        m_cancelled.push_back(queueId);
+        return true;
+    }
+
+    if (m_slots.linked(queueId))
+    {
+        m_slots.remove((int)m_slots[queueId].request.priority(), queueId);
+        m_routes.erase(queueId);
+        m_release(queueId);
+        return true;
+    }
+
+    // the timer of a delayed request is left in the wheel, it's ignored once it expires
+    if (m_qDelayed.erase(queueId) > 0)
+    {
+        m_publishCounts();
+        m_routes.erase(queueId);
+        m_release(queueId);
+        return true;
+    }
+
+    const auto itShed = std::find(m_shed.begin(), m_shed.end(), queueId);
+    if (itShed != m_shed.end())
+    {
+        m_shed.erase(itShed);
+        m_routes.erase(queueId);
+        m_release(queueId);
+        return true;
+    }
+
+    if (m_response.queueId() == queueId)
+    {
+        m_response.clear();
+        m_responseId.store(QueueId::NONE, std::memory_order_release);
+        m_release(queueId);
+        m_wakeWorker();
+        return true;
+    }
+
+    // the ID is released when the response is set
+    if (m_inFlight == queueId)
+    {
+        m_cancelled.push_back(queueId);
+        return true;
+    }
+
+    // the handler is being called
+    return false;
+}
+
+template <class Policy>
+curl::QueueId curl::BasicThreadSharedData<Policy>::scheduleRequest(const curl::Request& req, const curl::Priority& priority,
+                                                                    const std::chrono::steady_clock::time_point& at)
+{
+    lock_guard lg(m_mtx);
+
+    curl::QueueId id = m_getNewQueueId();
+
+    if (id.isValid())
+    {
+        const int64_t due = std::chrono::duration_cast<std::chrono::milliseconds>(at.time_since_epoch()).count();
+
+        try
+        {
+            m_advanceTimers();
+
+            Scheduled& sch = m_scheduled[id];
+            sch.request = BasicThreadSharedData::Request(req, id, priority);
+            sch.base_ms = due;
+            sch.interval_ms = 0;
+            sch.jitter_ms = 0;
+            sch.pending = false;
+            m_setCharge(id, priority, 0); // the firings are not charged, only their responses
+            sch.timerSeq = m_insertTimer(id, due);
+        }
+        catch (...)
+        {
+            m_scheduled.erase(id);
+            m_rmQueueId(id);
+            id = QueueId::FAILED;
+        }
+
+        m_publishCounts();
+    }
+
+    return id;
+}
+
+template <class Policy>
+curl::QueueId curl::BasicThreadSharedData<Policy>::scheduleRecurring(const curl::Request& req, const curl::Priority& priority,
+                                                                      const std::chrono::milliseconds& interval, const std::chrono::milliseconds& jitter)
+{
+    lock_guard lg(m_mtx);
+
+    curl::QueueId id = m_getNewQueueId();
+
+    if (id.isValid())
+    {
+        try
+        {
+            m_advanceTimers();
+
+            Scheduled& sch = m_scheduled[id];
+            sch.request = BasicThreadSharedData::Request(req, id, priority);
+            sch.base_ms = m_timer.now();
+            sch.interval_ms = (interval.count() > 0 ? (int64_t)interval.count() : 1);
+            sch.jitter_ms = (jitter.count() > 0 ? (int64_t)jitter.count() : 0);
+            sch.pending = false;
+            m_setCharge(id, priority, 0); // the firings are not charged, only their responses
+            sch.timerSeq = m_insertTimer(id, sch.base_ms + curl::random(0, (int)sch.jitter_ms));
+        }
+        catch (...)
+        {
+            m_scheduled.erase(id);
+            m_rmQueueId(id);
+            id = QueueId::FAILED;
+        }
+
+        m_publishCounts();
+    }
+
+    return id;
+}
+
+template <class Policy>
+bool curl::BasicThreadSharedData<Policy>::cancelSchedule(const curl::QueueId& queueId)
+{
+    lock_guard lg(m_mtx);
+
+    const auto it = m_scheduled.find(queueId);
+    const bool found = (it != m_scheduled.end());
+
+    if (found)
+    {
+        // the timer is left in the wheel, it's ignored once it expires
+        const bool pending = it->second.pending;
+        m_scheduled.erase(it);
+        m_publishCounts();
+
+        // otherwise the ID is released when the response is popped
+        if (!pending) { m_rmQueueId(queueId); }
+    }
+
+    return found;
+}
+
+template <class Policy>
+int curl::BasicThreadSharedData<Policy>::completionFd()
+{
+    curl::CompletionQueuePtr queue;
+
+    {
+        lock_guard lg(m_mtx);
+        queue = m_getDefaultQueue();
+    }
+
+    return (queue ? queue->fd() : -1);
+}
+
+template <class Policy>
+std::vector<curl::Completion> curl::BasicThreadSharedData<Policy>::drainCompletions()
+{
+    curl::CompletionQueuePtr queue;
+
+    {
+        lock_guard lg(m_mtx);
+        queue = m_defaultQueue;
+    }
+
+    return (queue ? queue->drain() : std::vector<curl::Completion>());
+}
+
+template <class Policy>
+curl::Response curl::BasicThreadSharedData<Policy>::popResponse()
+{
+    curl::Response res;
+    popResponse(res);
+    return res;
+}
+
+template <class Policy>
+void curl::BasicThreadSharedData<Policy>::popResponse(curl::Response& res)
+{
+    lock_guard lg(m_mtx);
+
+    const QueueId id = m_response.queueId();
+    if (id.isValid())
+    {
+        curl::trace::record(curl::trace::Event::popped, id);
+        if (!m_charges.empty()) { m_setCharge(id, m_charges[id].priority, 0); }
+    }
+
+    // IDs of recurring requests stay reserved until the schedule is cancelled
+    const auto it = m_scheduled.find(id);
+    if (it != m_scheduled.end()) { it->second.pending = false; }
+    else { m_rmQueueId(id); }
+
+    // the internal response keeps the buffers of `res` for the next one
+    std::swap(res, static_cast<curl::Response&>(m_response));
+    m_response.clear();
+    m_responseId.store(QueueId::NONE, std::memory_order_release);
+    m_wakeWorker();
+}
+
+template <class Policy>
+void curl::BasicThreadSharedData<Policy>::setRateLimit(const std::string& hostOrPrefix, double rate, double burst)
+{
+    lock_guard lg(m_mtx);
+
+    TokenBucket tb;
+    tb.urlPrefix = (hostOrPrefix.find("://") != std::string::npos);
+    tb.match = (tb.urlPrefix ? hostOrPrefix : curl::util::urlHost(hostOrPrefix));
+    tb.rate = (rate > 0 ? rate : 0);
+    tb.burst = (burst > 1 ? burst : 1);
+    tb.tokens = tb.burst;
+    tb.t_ms = curl::util::steadyTime_ms();
+
+    for (size_t i = 0; i < m_rateLimits.size(); ++i)
+    {
+        if (m_rateLimits[i].match == tb.match)
+        {
+            if (tb.tokens > m_rateLimits[i].tokens) { tb.tokens = m_rateLimits[i].tokens; } // don't refill by updating
+            m_rateLimits[i] = tb;
+            return;
+        }
+    }
+
+    m_rateLimits.push_back(tb);
+    ++m_rateLimitGen;
+}
+
+template <class Policy>
+bool curl::BasicThreadSharedData<Policy>::removeRateLimit(const std::string& hostOrPrefix)
+{
+    lock_guard lg(m_mtx);
+
+    const std::string match = ((hostOrPrefix.find("://") != std::string::npos) ? hostOrPrefix : curl::util::urlHost(hostOrPrefix));
+
+    for (size_t i = 0; i < m_rateLimits.size(); ++i)
+    {
+        if (m_rateLimits[i].match == match)
+        {
+            m_rateLimits.erase(m_rateLimits.begin() + i);
+            ++m_rateLimitGen;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+template <class Policy>
+void curl::BasicThreadSharedData<Policy>::setByteBudget(const curl::ByteBudget& budget)
+{
+    lock_guard lg(m_mtx);
+
+    m_suspendShards();
+    m_budget = budget;
+
+    if (budget.enabled() && m_charges.empty())
+    {
+        Charge tmp;
+        tmp.priority = Priority::normal;
+        tmp.bytes = 0;
+        m_charges.assign(Policy::capacity + 1, tmp);
+    }
+
+    m_updateShardLevels();
+    m_budgetCv.notify_all();
+}
+
+template <class Policy>
+void curl::BasicThreadSharedData<Policy>::setBatching(const std::string& url, const curl::BatchConfig& config)
+{
+    lock_guard lg(m_mtx);
+
+    m_suspendShards();
+
+    const auto it = m_batchers.find(url);
+
+    if (it != m_batchers.end()) { it->second.config = config; }
+    else
+    {
+        Batcher b;
+        b.config = config;
+        b.bytes = 0;
+        b.due_ms = 0;
+        b.timerSeq = 0;
+
+        m_batchers.insert(std::make_pair(url, b));
+    }
+
+    m_updateShardLevels();
+}
+
+template <class Policy>
+bool curl::BasicThreadSharedData<Policy>::removeBatching(const std::string& url)
+{
+    lock_guard lg(m_mtx);
+
+    const auto it = m_batchers.find(url);
+    if (it == m_batchers.end()) { return false; }
+
+    m_flushBatch(it->second);
+    m_batchers.erase(it);
+    m_updateShardLevels();
+
+    return true;
+}
+
+template <class Policy>
+int curl::BasicThreadSharedData<Policy>::openSpool(const std::string& filename, const curl::SpoolConfig& config)
+{
+    lock_guard lg(m_mtx);
+
+    if (m_spool) { return -1; }
+
+    std::unique_ptr<curl::Spool> spool(new curl::Spool());
+    std::vector<curl::Spool::Record> pending;
+
+    if (!spool->open(filename, config.capacity(), config.commitInterval(), &pending)) { return -1; }
+
+    m_suspendShards();
+    m_spool = std::move(spool);
+    m_spoolConfig = config;
+    m_spoolSeq.assign(Policy::capacity + 1, 0);
+    m_updateShardLevels();
+
+    int replayed = 0;
+
+    for (size_t i = 0; i < pending.size(); ++i)
+    {
+        const curl::Spool::Record& rec = pending[i];
+
+        // the replayed request refers to its existing record
+        const curl::QueueId id = m_queueRequest(rec.request, rec.priority, rec.seq);
+        if (!id.isValid()) { continue; }
+
+        try
+        {
+            const curl::ReplayHandler handler = m_spoolConfig.replayHandler();
+            const curl::Request request = rec.request;
+            BasicThreadSharedData::Slot& slot = m_slots[id];
+            slot.handler = [handler, request](const curl::Response& res) {
+                if (handler) { handler(request, res); }
+            };
+            slot.hasHandler = true;
+
+            ++replayed;
+        }
+        catch (...)
+        {
+            m_spoolSeq[id] = 0; // kept for the next run
+            m_unqueue(id, rec.priority);
+            m_release(id);
+        }
+    }
+
+    return replayed;
+}
+
+template <class Policy>
+bool curl::BasicThreadSharedData<Policy>::setSharding(const curl::ShardConfig& config)
+{
+    lock_guard lg(m_mtx);
+
+    if (config.shards() == 0)
+    {
+        m_shardingEnabled = false;
+        m_updateShardLevels();
+        return true;
+    }
+
+    if (m_shardingEnabled || (config.ringCapacity() == 0)) { return false; }
+
+    if (m_sharded.load(std::memory_order_relaxed))
+    {
+        // producers may still use the shards of the first call, so they are reused
+        if ((config.shards() != m_shardConfig.shards()) || (config.ringCapacity() != m_shardConfig.ringCapacity())) { return false; }
+    }
+    else
+    {
+        try
+        {
+            for (size_t i = 0; i < config.shards(); ++i) { m_shards.push_back(std::unique_ptr<Shard>(new Shard(config.ringCapacity()))); }
+        }
+        catch (...)
+        {
+            m_shards.clear();
+            return false;
+        }
+
+        // the shards keep at most a quarter of the IDs
+        m_shardIds = std::max<size_t>(1, std::min<size_t>(shardIdBatch, Policy::capacity / (4 * config.shards())));
+
+        m_shardConfig = config;
+        m_sharded.store(true, std::memory_order_release);
+    }
+
+    m_shardingEnabled = true;
+    m_updateShardLevels();
+
+    return true;
+}
+
+template <class Policy>
+void curl::BasicThreadSharedData<Policy>::setHedgeLimit(double ratio, double burst)
+{
+    lock_guard lg(m_mtx);
+
+    m_hedgeRatio = (ratio > 0 ? ratio : 0);
+    m_hedgeBurst = (burst > 1 ? burst : 1);
+    if (m_hedgeTokens > m_hedgeBurst) { m_hedgeTokens = m_hedgeBurst; }
+}
+
+template <class Policy>
+curl::Stats curl::BasicThreadSharedData<Policy>::getStats() const
+{
+    lock_guard lg(m_mtx);
+
+    curl::Stats stats = m_stats;
+
+    stats.budgetUsed = m_budgetUsed[0] + m_budgetUsed[1] + m_budgetUsed[2];
+
+    stats.qNormal = m_slots.size((int)Priority::normal) + m_shardedSize(Priority::normal);
+    stats.qHigh = m_slots.size((int)Priority::high) + m_shardedSize(Priority::high);
+    stats.qMax = m_slots.size((int)Priority::max) + m_shardedSize(Priority::max);
+    stats.qDelayed = m_qDelayed.size();
+    stats.scheduled = m_scheduled.size();
+    stats.spoolCommits = (m_spool ? m_spool->commits() : 0);
+
+    const int64_t now = curl::util::steadyTime_ms();
+
+    for (auto it = m_breakers.begin(); it != m_breakers.end(); ++it)
+    {
+        const Breaker& b = it->second;
+
+        Stats::Breaker tmp;
+        tmp.host = it->first;
+        tmp.state = b.state;
+        tmp.consecutiveFailures = b.consecutiveFailures;
+        tmp.windowRequests = (int)b.window.size();
+        tmp.windowFailures = b.windowFailures;
+        tmp.rejected = b.rejected;
+
+        // the transition to half open is done lazily by `circuitAllow()`
+        if ((b.state == CircuitState::open) && ((now - b.openedAt_ms) >= m_breakerConfig.openDuration())) { tmp.state = CircuitState::halfOpen; }
+
+        stats.breakers.push_back(tmp);
+    }
+
+    return stats;
+}
+
+/**
+ * @param spoolSeq Sequence number of the spool record of a replayed request, 0 to append a record if the request has to
+ * be spooled
+ */
+template <class Policy>
+curl::QueueId curl::BasicThreadSharedData<Policy>::m_queueRequest(const curl::Request& req, const curl::Priority& priority, uint64_t spoolSeq)
+{
+    m_drainShards(); // keeps the order of the requests of the calling thread
+
+    const size_t bytes = req.body().size();
+    if (!m_budgetAdmit(priority, bytes)) { return QueueId::OVER_BUDGET; }
+    if (!m_shedAdmit(priority)) { return QueueId::FAILED; }
+
+    curl::QueueId id = m_getNewQueueId();
+
+    if (id.isValid())
+    {
+        curl::trace::record(curl::trace::Event::queued, id);
+        ++m_stats.queued;
+
+        // the slot of a free ID is unlinked, its request is only reused for the buffers
+        BasicThreadSharedData::Request& tmp = m_slots[id].request;
+
+        try
+        {
+            tmp.assign(req, id, priority);
+            if (m_spool) { m_spoolAppend(tmp, spoolSeq); }
+
+            BasicThreadSharedData::Batcher* const batcher = m_findBatcher(tmp);
+            if (batcher) { m_addToBatch(*batcher, tmp); }
+            else { m_push(tmp); }
+
+            m_setCharge(id, priority, bytes);
+        }
+        catch (...)
+        {
+            m_rmQueueId(id);
+            id = QueueId::FAILED;
+        }
+    }
+
+    return id;
+}
+
+/**
+ * Sheds queued requests according to the policy until a request of `priority` can be admitted.
+ *
+ * @return `true` if the request can be admitted
+ */
+template <class Policy>
+bool curl::BasicThreadSharedData<Policy>::m_shedAdmit(const curl::Priority& priority)
+{
+    if (m_shedConfig.capacity() == 0) { return true; }
+
+    const size_t limit = m_shedConfig.limit(priority);
+
+    while (m_slots.size() >= limit)
+    {
+        int victims = -1; // priority level
+
+        switch (m_shedConfig.policy())
+        {
+        case ShedPolicy::reject:
+            break;
+
+        case ShedPolicy::evictLowerPriority:
+            if ((priority != Priority::normal) && !m_slots.empty((int)Priority::normal)) { victims = (int)Priority::normal; }
+            else if ((priority == Priority::max) && !m_slots.empty((int)Priority::high)) { victims = (int)Priority::high; }
+            break;
+
+        case ShedPolicy::dropOldest:
+            if (!m_slots.empty((int)priority)) { victims = (int)priority; }
+            break;
+        }
+
+        if (victims < 0) { return false; }
+
+        // the queue ID stays reserved until the `E_SHED` response is popped
+        const curl::QueueId::id_type victim = m_slots.front(victims);
+        m_setCharge(victim, m_slots[victim].request.priority(), 0);
+        m_shed.push_back(victim);
+        ++m_stats.shed;
+        m_slots.remove(victims, victim);
+        m_wakeWorker();
+    }
+
+    return true;
+}
+
+/**
+ * @return `true` if the charges plus `bytes` are within the limits
+ */
+template <class Policy>
+bool curl::BasicThreadSharedData<Policy>::m_budgetAdmit(const curl::Priority& priority, size_t bytes) const
+{
+    if (!m_budget.enabled()) { return true; }
+
+    const size_t used = m_budgetUsed[0] + m_budgetUsed[1] + m_budgetUsed[2];
+    const size_t limit = m_budget.limit(priority);
+
+    return (((m_budget.total() == 0) || ((used + bytes) <= m_budget.total())) && ((limit == 0) || ((m_budgetUsed[(int)priority] + bytes) <= limit)));
+}
+
+/**
+ * @return `true` if `bytes` fit into the budget at all, i.e. once all charges are released
+ */
+template <class Policy>
+bool curl::BasicThreadSharedData<Policy>::m_budgetFits(const curl::Priority& priority, size_t bytes) const
+{
+    const size_t limit = m_budget.limit(priority);
+    return (((m_budget.total() == 0) || (bytes <= m_budget.total())) && ((limit == 0) || (bytes <= limit)));
+}
+
+/**
+ * Replaces the charge of a queue ID. No op if no budget has been set yet.
+ */
+template <class Policy>
+void curl::BasicThreadSharedData<Policy>::m_setCharge(curl::QueueId::id_type id, const curl::Priority& priority, size_t bytes)
+{
+    if (m_charges.empty() || (id < curl::QueueId::BASE) || (id > Policy::capacity)) { return; }
+
+    Charge& c = m_charges[id];
+    const bool released = (bytes < c.bytes) || (priority != c.priority);
+
+    m_budgetUsed[(int)c.priority] -= c.bytes;
+    m_budgetUsed[(int)priority] += bytes;
+    c.priority = priority;
+    c.bytes = bytes;
+
+    if (released) { m_budgetCv.notify_all(); }
+}
+
+template <class Policy>
+void curl::BasicThreadSharedData<Policy>::m_chargeResponse(curl::QueueId::id_type id, size_t bytes)
+{
+    if (!m_charges.empty() && (id >= curl::QueueId::BASE) && (id <= Policy::capacity)) { m_setCharge(id, m_charges[id].priority, bytes); }
+}
+
+/**
+ * Copies the request into the slot of its queue ID, if it's not already there, and appends the slot to the queue.
+ */
+template <class Policy>
+void curl::BasicThreadSharedData<Policy>::m_push(const BasicThreadSharedData::Request& req)
+{
+    const curl::QueueId::id_type id = req.queueId();
+    BasicThreadSharedData::Slot& slot = m_slots[id];
+
+    if (&slot.request != &req) { slot.request = req; }
+    m_resolveRateLimit(slot);
+    m_slots.push((int)slot.request.priority(), id);
+
+    m_wakeWorker();
+}
+
+/**
+ * A matching URL prefix wins over the host, of two matching prefixes the longer one wins.
+ *
+ * @return Index of the most specific rate limit matching the URL, or -1
+ */
+template <class Policy>
+int curl::BasicThreadSharedData<Policy>::m_matchRateLimit(const std::string& url) const
+{
+    int r = -1;
+
+    if (!m_rateLimits.empty())
+    {
+        const std::string host = curl::util::urlHost(url);
+
+        for (size_t i = 0; i < m_rateLimits.size(); ++i)
+        {
+            const TokenBucket& tmp = m_rateLimits[i];
+            const bool match = (tmp.urlPrefix ? (url.compare(0, tmp.match.size(), tmp.match) == 0) : (host == tmp.match));
+            if (!match) { continue; }
+
+            const TokenBucket* const best = ((r >= 0) ? &m_rateLimits[r] : nullptr);
+
+            // the hosts are unique, so two matching limits are a host and a prefix or two prefixes
+            if (!best || (tmp.urlPrefix && (!best->urlPrefix || (tmp.match.size() > best->match.size())))) { r = (int)i; }
+        }
+    }
+
+    return r;
+}
+
+/**
+ * Matches the request of the slot against the rate limits and caches the result in the slot, called when the request
+ * is queued.
+ */
+template <class Policy>
+void curl::BasicThreadSharedData<Policy>::m_resolveRateLimit(BasicThreadSharedData::Slot& slot)
+{
+    slot.rateLimit = (m_rateLimits.empty() ? -1 : m_matchRateLimit(slot.request.url()));
+    slot.rateLimitGen = m_rateLimitGen;
+}
+
+/**
+ * @return The rate limit of the request in the slot, or `nullptr`. Only matches again if the rate limits have changed
+ * since the request has been queued.
+ */
+template <class Policy>
+typename curl::BasicThreadSharedData<Policy>::TokenBucket* curl::BasicThreadSharedData<Policy>::m_findRateLimit(BasicThreadSharedData::Slot& slot)
+{
+    if (slot.rateLimitGen != m_rateLimitGen) { m_resolveRateLimit(slot); }
+    return ((slot.rateLimit >= 0) ? &m_rateLimits[(size_t)slot.rateLimit] : nullptr);
+}
+
+/**
+ * @param [out] wait_ms Time until the next token is available, only set if no token was taken
+ * @return `true` if a token was taken
+ */
+template <class Policy>
+bool curl::BasicThreadSharedData<Policy>::TokenBucket::take(int64_t now_ms, long* wait_ms)
+{
+    if (now_ms > t_ms)
+    {
+        tokens += rate * (double)(now_ms - t_ms) / 1000.0;
+        if (tokens > burst) { tokens = burst; }
+        t_ms = now_ms;
+    }
+
+    const bool ok = (tokens >= 1.0);
+
+    if (ok) { tokens -= 1.0; }
+    else if (rate > 0) { *wait_ms = 1 + (long)((1.0 - tokens) * 1000.0 / rate); }
+    else { *wait_ms = 1000; }
+
+    return ok;
+}
+
+/**
+ * Queues the delayed and scheduled requests which are due. Due requests are appended to their priority queue, like
+ * newly queued requests.
+ */
+template <class Policy>
+void curl::BasicThreadSharedData<Policy>::m_advanceTimers()
+{
+    m_timer.advance(curl::util::steadyTime_ms(), [this](const TimerRef& timer) {
+        const auto itDelayed = m_qDelayed.find(timer.id);
+        if ((itDelayed != m_qDelayed.end()) && (itDelayed->second.timerSeq == timer.seq))
+        {
+            m_push(itDelayed->second.request);
+            m_qDelayed.erase(itDelayed);
+            return;
+        }
+
+        const auto itSch = m_scheduled.find(timer.id);
+        if ((itSch != m_scheduled.end()) && (itSch->second.timerSeq == timer.seq))
+        {
+            Scheduled& sch = itSch->second;
+
+            if (!sch.pending)
+            {
+                curl::trace::record(curl::trace::Event::queued, timer.id);
+                ++m_stats.queued;
+                m_push(sch.request);
+                sch.pending = true;
+            }
+
+            if (sch.interval_ms > 0)
+            {
+                // skip firings which have been missed, e.g. while the worker was blocked
+                sch.base_ms += sch.interval_ms;
+                if (sch.base_ms < m_timer.now()) { sch.base_ms = m_timer.now(); }
+
+                sch.timerSeq = m_insertTimer(timer.id, sch.base_ms + curl::random(0, (int)sch.jitter_ms));
+            }
+            else { m_scheduled.erase(itSch); }
+
+            return;
+        }
+
+        for (auto it = m_batchers.begin(); it != m_batchers.end(); ++it)
+        {
+            Batcher& b = it->second;
+
+            if (!b.items.empty() && (b.items[0].queueId() == timer.id) && (b.timerSeq == timer.seq))
+            {
+                m_flushBatch(b);
+                return;
+            }
+        }
+    });
+
+    m_publishCounts();
+}
+
+/**
+ * Publishes the sizes which are read without the lock, see `getQDelayedSize()` and `getScheduledCount()`.
+ */
+template <class Policy>
+void curl::BasicThreadSharedData<Policy>::m_publishCounts()
+{
+    m_qDelayedSize.store(m_qDelayed.size(), std::memory_order_relaxed);
+    m_scheduledCount.store(m_scheduled.size(), std::memory_order_relaxed);
+}
+
+template <class Policy>
+uint64_t curl::BasicThreadSharedData<Policy>::m_insertTimer(curl::QueueId::id_type id, int64_t due_ms)
+{
+    TimerRef timer;
+    timer.id = id;
+    timer.seq = ++m_timerSeq;
+    m_timer.insert(due_ms, timer);
+
+    // the worker might sleep longer than until this timer is due
+    m_wakeWorker();
+
+    return timer.seq;
+}
+
+/**
+ * Releases the slot of `id`, the request is unlinked from its queue. No op if `id` is not in use.
+ */
+template <class Policy>
+void curl::BasicThreadSharedData<Policy>::m_rmQueueId(curl::QueueId::id_type id)
+{
+    // the request is completed, or it has been rolled back
+    if (!m_spoolSeq.empty() && (id >= curl::QueueId::BASE) && (id <= Policy::capacity) && (m_spoolSeq[id] != 0))
+    {
+        m_spool->trim(m_spoolSeq[id]);
+        m_spoolSeq[id] = 0;
+    }
+
+    if (m_slots.acquired(id))
+    {
+        BasicThreadSharedData::Slot& slot = m_slots[id];
+
+        if (m_slots.linked(id)) { m_slots.remove((int)slot.request.priority(), id); }
+        slot.handler = nullptr;
+        slot.hasHandler = false;
+        m_slots.release(id);
+    }
+}
+
+/**
+ * Releases the queue ID and its charge.
+ */
+template <class Policy>
+void curl::BasicThreadSharedData<Policy>::m_release(curl::QueueId::id_type id)
+{
+    if (!m_charges.empty() && (id >= curl::QueueId::BASE) && (id <= Policy::capacity)) { m_setCharge(id, m_charges[id].priority, 0); }
+    m_rmQueueId(id);
+}
+
+/**
+ * @return The queue of `curl::Delivery::completionFd`, null if it could not be created
+ */
+template <class Policy>
+const curl::CompletionQueuePtr& curl::BasicThreadSharedData<Policy>::m_getDefaultQueue()
+{
+    if (!m_defaultQueue)
+    {
+        try
+        {
+            m_defaultQueue = std::make_shared<curl::CompletionQueue>(*this);
+        }
+        catch (...)
+        {}
+    }
+
+    return m_defaultQueue;
+}
+
+/**
+ * Acquires the lowest unused ID in range [`curl::QueueId::BASE`, `Policy::capacity`], returns `curl::QueueId::FAILED`
+ * if all are in use.
+ */
+template <class Policy>
+curl::QueueId curl::BasicThreadSharedData<Policy>::m_getNewQueueId()
+{
+    static_assert((curl::QueueId::BASE > 0) &&                             // see curl::QueueId::isValid()
+                      (curl::QueueId::MAX <= INT16_MAX) &&                 // the latter two ensure that the doc of this
+                      (sizeof(curl::QueueId::id_type) >= sizeof(int16_t)), // func is true on all possible platormfms
+                  "see comments");
+
+
+    typename BasicThreadSharedData::Queue::index_type id = m_slots.acquire();
+
+    // the IDs cached by the shards are given back before the pool runs dry for the other paths
+    if ((id == BasicThreadSharedData::Queue::none) && (m_reclaimShardIds() > 0)) { id = m_slots.acquire(); }
+
+    // if ((id > 100) || (id < 0)) { LOG_WRN("new queue ID: %i", id); }
+
+    return ((id != BasicThreadSharedData::Queue::none) ? curl::QueueId(id) : curl::QueueId(curl::QueueId::FAILED));
+}
+
+/**
+ * Removes the request which has just been queued by `m_queueRequest()`.
+ */
+template <class Policy>
+void curl::BasicThreadSharedData<Policy>::m_unqueue(curl::QueueId::id_type id, const curl::Priority& priority)
+{
+    if (!m_slots.empty((int)priority) && (m_slots.back((int)priority) == id))
+    {
+        m_slots.remove((int)priority, id);
+        return;
+    }
+
+    for (auto it = m_batchers.begin(); it != m_batchers.end(); ++it)
+    {
+        Batcher& b = it->second;
+
+        if (!b.items.empty() && (b.items.back().queueId() == id))
+        {
+            b.bytes -= b.items.back().body().size();
+            b.items.pop_back();
+            return;
+        }
+    }
+
+    // it completed a batch, which is sent anyway
+    for (auto it = m_batches.begin(); it != m_batches.end(); ++it)
+    {
+        std::vector<curl::QueueId::id_type>& members = it->second;
+        if (!members.empty() && (members.back() == id)) { members.pop_back(); }
+    }
+}
+
+/**
+ * @return The batcher of the request, or `nullptr` if it's sent on its own
+ */
+template <class Policy>
+typename curl::BasicThreadSharedData<Policy>::Batcher* curl::BasicThreadSharedData<Policy>::m_findBatcher(const BasicThreadSharedData::Request& req)
+{
+    if (m_batchers.empty() || (req.method() != curl::Method::POST) || req.upload() || req.download()) { return nullptr; }
+
+    const auto it = m_batchers.find(req.url());
+    if ((it == m_batchers.end()) || !it->second.config.enabled() || (req.body().size() > it->second.config.maxItemSize())) { return nullptr; }
+
+    return &(it->second);
+}
+
+template <class Policy>
+void curl::BasicThreadSharedData<Policy>::m_addToBatch(BasicThreadSharedData::Batcher& batcher, const BasicThreadSharedData::Request& req)
+{
+    const BatchConfig& config = batcher.config;
+
+    if (batcher.items.empty())
+    {
+        batcher.due_ms = curl::util::steadyTime_ms() + config.maxDelay();
+        batcher.timerSeq = m_insertTimer(req.queueId(), batcher.due_ms);
+    }
+
+    batcher.items.push_back(req);
+    batcher.bytes += req.body().size();
+
+    if ((batcher.items.size() >= config.maxItems()) || ((config.maxBytes() > 0) && (batcher.bytes >= config.maxBytes()))) { m_flushBatch(batcher); }
+}
+
+/**
+ * Queues the collected requests as one request, which carries the queue ID of the first one.
+ */
+template <class Policy>
+void curl::BasicThreadSharedData<Policy>::m_flushBatch(BasicThreadSharedData::Batcher& batcher)
+{
+    if (batcher.items.empty()) { return; }
+
+    const BatchConfig& config = batcher.config;
+    BasicThreadSharedData::Request batch = batcher.items[0];
+
+    std::vector<const std::string*> bodies;
+    bodies.reserve(batcher.items.size());
+    for (size_t i = 0; i < batcher.items.size(); ++i) { bodies.push_back(&(batcher.items[i].body())); }
+
+    batch.setBody(config.join(bodies));
+
+    if (!config.contentType().empty())
+    {
+        std::vector<curl::HeaderField> header;
+
+        for (size_t i = 0; i < batch.header().size(); ++i)
+        {
+            if (!batch.header()[i].keyView().equalsIgnoreCase("Content-Type")) { header.push_back(batch.header()[i]); }
+        }
+
+        header.push_back(curl::HeaderField("Content-Type", config.contentType()));
+        batch.setHeader(header);
+    }
+
+    std::vector<curl::QueueId::id_type>& members = m_batches[batch.queueId()];
+    for (size_t i = 1; i < batcher.items.size(); ++i) { members.push_back(batcher.items[i].queueId()); }
+
+    ++m_stats.batches;
+    m_stats.batched += batcher.items.size();
+
+    batcher.items.clear();
+    batcher.bytes = 0;
+
+    m_push(batch);
+}
+
+/**
+ * Appends the request to the spool if its priority is spooled, or adopts the record of a replayed request.
+ */
+template <class Policy>
+void curl::BasicThreadSharedData<Policy>::m_spoolAppend(const BasicThreadSharedData::Request& req, uint64_t spoolSeq)
+{
+    const curl::QueueId::id_type id = req.queueId();
+
+    if (spoolSeq != 0) { m_spoolSeq[id] = spoolSeq; }
+    else if (m_spoolConfig.spooled(req.priority()) && curl::Spool::spoolable(req))
+    {
+        const uint64_t seq = m_spool->append(req, req.priority());
+
+        if (seq != 0)
+        {
+            m_spoolSeq[id] = seq;
+            ++m_stats.spooled;
+        }
+        else { ++m_stats.spoolFull; }
+    }
+}
+
+template <class Policy>
+curl::BasicThreadSharedData<Policy>::Shard::Shard(size_t ringCapacity)
+    : lock(), rings(), ids()
+{
+    for (int i = 0; i < Queue::priorityLevels; ++i) { rings[i].reset(new curl::SpscRing<curl::QueueId::id_type>(ringCapacity)); }
+    ids.reserve(shardIdBatch);
+}
+
+/**
+ * Writes the request into the slot of an ID cached by the calling thread's shard and pushes the ID into the ring.
+ * `m_mtx` is only locked to refill the IDs of the shard and to wake up the worker. It's never locked while a shard lock
+ * is held, so that `m_mtx` can be locked before the shard locks.
+ *
+ * @return `curl::QueueId::NONE` if the ring is full or sharding has been disabled meanwhile, the request has to take the
+ * locked path then
+ */
+template <class Policy>
+curl::QueueId curl::BasicThreadSharedData<Policy>::m_submit(const curl::Request& req, const curl::Priority& priority)
+{
+    const size_t shardIndex = producerIndex() % m_shards.size();
+    const uint64_t pendingBit = (uint64_t(1) << (shardIndex % 64));
+    Shard& shard = *m_shards[shardIndex];
+    curl::QueueId id;
+
+    {
+        std::unique_lock<curl::SpinLock> shardLock(shard.lock);
+
+        if (shard.ids.empty())
+        {
+            shardLock.unlock();
+
+            curl::QueueId::id_type ids[shardIdBatch];
+            size_t n = 0;
+
+            {
+                lock_guard lg(m_mtx);
+
+                while (n < m_shardIds)
+                {
+                    const curl::QueueId tmp = m_getNewQueueId();
+                    if (!tmp.isValid()) { break; }
+                    ids[n++] = tmp;
+                }
+            }
+
+            if (n == 0) { return QueueId::FAILED; }
+
+            shardLock.lock();
+
+            // another producer of the shard may have refilled it meanwhile, the IDs are taken from the back
+            while ((n > 0) && (shard.ids.size() < m_shardIds)) { shard.ids.push_back(ids[--n]); }
+
+            if (n > 0)
+            {
+                shardLock.unlock();
+
+                lock_guard lg(m_mtx);
+                for (size_t i = 0; i < n; ++i) { m_slots.release(ids[i]); }
+
+                shardLock.lock();
+            }
+
+            if (shard.ids.empty()) { return QueueId::FAILED; }
+        }
+
+        // re-checked under the shard lock, see `m_updateShardLevels()`
+        if ((m_shardLevels.load(std::memory_order_acquire) & (1u << (int)priority)) == 0) { return QueueId::NONE; }
+
+        curl::SpscRing<curl::QueueId::id_type>& ring = *shard.rings[(int)priority];
+        curl::QueueId::id_type* const entry = ring.back();
+        if (!entry) { return QueueId::NONE; }
+
+        id = shard.ids.back();
+
+        try
+        {
+            m_slots[id].request.assign(req, id, priority);
+        }
+        catch (...)
+        {
+            return QueueId::FAILED;
+        }
+
+        shard.ids.pop_back();
+        curl::trace::record(curl::trace::Event::queued, id);
+        *entry = id;
+        ring.push();
+    }
+
+    // always the RMW, even if the bit is already set: it orders the push before the read by the worker's exchange in
+    // `m_drainShards()`, otherwise the worker could clear the bit without seeing the pushed ID
+    m_shardPending.fetch_or(pendingBit);
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (m_workerWaiting.load(std::memory_order_relaxed) && m_workerWaiting.exchange(false))
+    {
+        lock_guard lg(m_mtx);
+        m_wakeWorker();
+    }
+
+    return id;
+}
+
+/**
+ * Links the submitted requests into the priority queues, the requests of a ring keep their order.
+ *
+ * Has to be called with `m_mtx` locked.
+ */
+template <class Policy>
+void curl::BasicThreadSharedData<Policy>::m_drainShards()
+{
+    if (!m_sharded.load(std::memory_order_relaxed) || (m_shardPending.load(std::memory_order_relaxed) == 0)) { return; }
+
+    // cleared before merging, a request pushed meanwhile sets the bit again
+    const uint64_t pending = m_shardPending.exchange(0);
+
+    for (size_t i = 0; i < m_shards.size(); ++i)
+    {
+        if ((pending & (uint64_t(1) << (i % 64))) == 0) { continue; }
+
+        for (int level = 0; level < Queue::priorityLevels; ++level)
+        {
+            curl::SpscRing<curl::QueueId::id_type>& ring = *m_shards[i]->rings[level];
+
+            for (const curl::QueueId::id_type* id = ring.front(); id; id = ring.front())
+            {
+                m_resolveRateLimit(m_slots[*id]);
+                m_slots.push(level, *id);
+                ring.pop();
+
+                ++m_stats.queued;
+                ++m_stats.sharded;
+            }
+        }
+    }
+}
+
+/**
+ * Selects the priorities which are submitted through the shards, and merges the rings so that the requests submitted
+ * before come first. If no priority is left, the IDs cached by the shards are released.
+ *
+ * Has to be called with `m_mtx` locked, after sharding has been enabled or disabled, and after every change of the byte
+ * budget, load shedding, batching or spool.
+ */
+/**
+ * Closes the shards before a setting changes which requests have to take the locked path. The producers which have
+ * seen the previous levels are waited for and their requests are merged, `m_updateShardLevels()` opens the shards
+ * again once the setting has been changed.
+ *
+ * Has to be called with `m_mtx` locked.
+ */
+template <class Policy>
+void curl::BasicThreadSharedData<Policy>::m_suspendShards()
+{
+    if (!m_sharded.load(std::memory_order_relaxed)) { return; }
+
+    m_shardLevels.store(0, std::memory_order_release);
+    for (size_t i = 0; i < m_shards.size(); ++i) { std::lock_guard<curl::SpinLock> shardLock(m_shards[i]->lock); }
+    m_drainShards();
+}
+
+template <class Policy>
+void curl::BasicThreadSharedData<Policy>::m_updateShardLevels()
+{
+    if (!m_sharded.load(std::memory_order_relaxed)) { return; }
+
+    unsigned levels = 0;
+
+    if (m_shardingEnabled && !m_budget.enabled() && (m_shedConfig.capacity() == 0) && m_batchers.empty())
+    {
+        for (int level = 0; level < Queue::priorityLevels; ++level)
+        {
+            if (!m_spool || !m_spoolConfig.spooled((Priority)level)) { levels |= (1u << level); }
+        }
+    }
+
+    m_shardLevels.store(levels, std::memory_order_release);
+
+    // a producer which has seen the previous levels has pushed its request once its shard lock is released
+    for (size_t i = 0; i < m_shards.size(); ++i) { std::lock_guard<curl::SpinLock> shardLock(m_shards[i]->lock); }
+
+    m_drainShards();
+    if (levels == 0) { m_reclaimShardIds(); }
+}
+
+/**
+ * Releases the IDs cached by the shards, they take new ones when they need them.
+ *
+ * Has to be called with `m_mtx` locked.
+ *
+ * @return Number of released IDs
+ */
+template <class Policy>
+size_t curl::BasicThreadSharedData<Policy>::m_reclaimShardIds()
+{
+    if (!m_sharded.load(std::memory_order_relaxed)) { return 0; }
+
+    size_t n = 0;
+
+    for (size_t i = 0; i < m_shards.size(); ++i)
+    {
+        Shard& shard = *m_shards[i];
+        std::lock_guard<curl::SpinLock> shardLock(shard.lock);
+
+        for (size_t j = 0; j < shard.ids.size(); ++j) { m_slots.release(shard.ids[j]); }
+        n += shard.ids.size();
+        shard.ids.clear();
+    }
+
+    return n;
+}
+
+/**
+ * Number of submitted requests which have not been merged yet. Doesn't lock, the value may be outdated.
+ */
+template <class Policy>
+size_t curl::BasicThreadSharedData<Policy>::m_shardedSize(const curl::Priority& priority) const
+{
+    if (!m_sharded.load(std::memory_order_acquire)) { return 0; }
+
+    size_t n = 0;
+    for (size_t i = 0; i < m_shards.size(); ++i) { n += m_shards[i]->rings[(int)priority]->size(); }
+    return n;
+}
+
+/**
+ * Has to be called with `m_mtx` locked.
+ */
+template <class Policy>
+void curl::BasicThreadSharedData<Policy>::m_wakeWorker()
+{
+    m_wake = true;
+    m_workCv.notify_one();
+}
+
+template <class Policy>
+typename curl::BasicThreadSharedData<Policy>::Request curl::BasicThreadSharedData<Policy>::popRequest()
+{
+    BasicThreadSharedData::Request r;
+    popRequest(r);
+    return r;
+}
+
+/**
+ * The request is swapped with the one in the slot, so that the slot keeps the buffers of `r` for reuse.
+ *
+ * @return `false` if no request is ready, `r` is cleared then
+ */
+template <class Policy>
+bool curl::BasicThreadSharedData<Policy>::popRequest(BasicThreadSharedData::Request& r)
+{
+    lock_guard lg(m_mtx);
+
+    m_drainShards();
+    m_advanceTimers();
+
+    // without rate limits this is just the front of the highest non empty queue, throttled requests are skipped
+    const int64_t now = (m_rateLimits.empty() ? 0 : curl::util::steadyTime_ms());
+    bool found = false;
+
+    m_throttleWait_ms = -1;
+
+    for (int level = (Queue::priorityLevels - 1); (level >= 0) && !found; --level)
+    {
+        for (auto id = m_slots.front(level); (id != Queue::none) && !found; id = m_slots.next(id))
+        {
+            TokenBucket* const tb = (m_rateLimits.empty() ? nullptr : m_findRateLimit(m_slots[id]));
+            long wait_ms = -1;
+
+            if (!tb || tb->take(now, &wait_ms))
+            {
+                m_slots.remove(level, id);
+                std::swap(r, m_slots[id].request);
+                found = true;
+            }
+            else if ((m_throttleWait_ms < 0) || (wait_ms < m_throttleWait_ms)) { m_throttleWait_ms = wait_ms; }
+        }
+    }
+
+    if (found)
+    {
+        ++m_stats.dispatched;
+        m_inFlight = r.queueId();
+    }
+    else { r.clear(); }
+
+    return found;
+}
+
+/**
+ * @return `true` if the response has been set and has to be popped, `false` if it has been passed to a completion
+ * handler or discarded
+ */
+template <class Policy>
+bool curl::BasicThreadSharedData<Policy>::setResponse(const curl::Response& res, const QueueId& queueId)
+{
+    curl::CompletionHandler handler;
+    curl::CompletionQueuePtr queue;
+
+    {
+        lock_guard lg(m_mtx);
+
+        ++m_stats.completed;
+        if (m_inFlight == queueId) { m_inFlight = QueueId::NONE; }
+
+        const auto itCancelled = std::find(m_cancelled.begin(), m_cancelled.end(), queueId);
+        if (itCancelled != m_cancelled.end())
+        {
+            m_cancelled.erase(itCancelled);
+            m_routes.erase(queueId);
+            m_release(queueId);
+            return false;
+        }
+
+        // requests which have not been performed due to the shutdown are replayed on the next open
+        if ((res.curlCode() == curl::Response::E_SHUTDOWN) && !m_spoolSeq.empty() && queueId.isValid()) { m_spoolSeq[queueId] = 0; }
+
+        // the route is kept until the completion is drained, so that it can be cancelled
+        const auto itRoute = m_routes.find(queueId);
+        BasicThreadSharedData::Slot* const slot = (m_slots.acquired(queueId) ? &m_slots[queueId] : nullptr);
+
+        if (itRoute != m_routes.end())
+        {
+            queue = itRoute->second;
+            m_chargeResponse(queueId, res.body().size());
+        }
+        else if (slot && slot->hasHandler)
+        {
+            // the ID stays reserved while the handler is called, so that it can't be cancelled by a new owner
+            handler.swap(slot->handler);
+            slot->hasHandler = false;
+        }
+        else
+        {
+            m_response.assign(res, queueId);
+            m_responseId.store(queueId, std::memory_order_release);
+
+            // the request body is not buffered anymore, the response body is
+            m_chargeResponse(queueId, res.body().size());
+
+            return true;
+        }
+    }
+
+    // pushed without holding the lock, the consumer only contends for the lock of its queue
+    if (queue)
+    {
+        queue->push(curl::Completion(queueId, res));
+        return false;
+    }
+
+    try
+    {
+        handler(res);
+    }
+    catch (...)
+    {}
+
+    lock_guard lg(m_mtx);
+    curl::trace::record(curl::trace::Event::popped, queueId);
+    m_release(queueId);
+
+    return false;
+}
+
+/**
+ * @return The queue ID of the next shed request, its `E_SHED` response has to be set
+ */
+template <class Policy>
+curl::QueueId curl::BasicThreadSharedData<Policy>::popShed()
+{
+    lock_guard lg(m_mtx);
+
+    curl::QueueId id;
+
+    if (!m_shed.empty())
+    {
+        id = m_shed.front();
+        m_shed.pop_front();
+    }
+
+    return id;
+}
+
+/**
+ * @return `true` if the response of the request has to be popped, i.e. it has neither a completion handler nor a
+ * completion queue
+ */
+template <class Policy>
+bool curl::BasicThreadSharedData<Policy>::deliversToSlot(const QueueId& queueId) const
+{
+    lock_guard lg(m_mtx);
+    return ((m_routes.find(queueId) == m_routes.end()) && !(m_slots.acquired(queueId) && m_slots[queueId].hasHandler) &&
+            (std::find(m_cancelled.begin(), m_cancelled.end(), queueId) == m_cancelled.end()));
+}
+
+/**
+ * Removes and returns all queued and delayed requests, and cancels the schedules. Their responses have to be set.
+ */
+template <class Policy>
+std::vector<typename curl::BasicThreadSharedData<Policy>::Request> curl::BasicThreadSharedData<Policy>::takeRemaining()
+{
+    lock_guard lg(m_mtx);
+
+    m_drainShards();
+    m_reclaimShardIds();
+
+    std::vector<BasicThreadSharedData::Request> r;
+    for (int level = (Queue::priorityLevels - 1); level >= 0; --level)
+    {
+        while (!m_slots.empty(level))
+        {
+            const curl::QueueId::id_type id = m_slots.front(level);
+            r.push_back(m_slots[id].request);
+            m_slots.remove(level, id);
+        }
+    }
+
+    for (auto it = m_qDelayed.begin(); it != m_qDelayed.end(); ++it) { r.push_back(it->second.request); }
+    m_qDelayed.clear();
+
+    for (auto it = m_batchers.begin(); it != m_batchers.end(); ++it)
+    {
+        r.insert(r.end(), it->second.items.begin(), it->second.items.end());
+        it->second.items.clear();
+        it->second.bytes = 0;
+    }
+
+    // the IDs of pending firings are released when their response is popped
+    for (auto it = m_scheduled.begin(); it != m_scheduled.end(); ++it)
+    {
+        if (!it->second.pending) { m_release(it->first); }
+    }
+    m_scheduled.clear();
+    m_publishCounts();
+
+    return r;
+}
+
+/**
+ * @return The hedge delay for a request to `host`, or -1 if it's not hedged
+ */
+template <class Policy>
+long curl::BasicThreadSharedData<Policy>::hedgeDelay(const std::string& host, const curl::HedgePolicy& policy) const
+{
+    lock_guard lg(m_mtx);
+
+    if (policy.percentile() > 0)
+    {
+        const auto it = m_latencies.find(host);
+
+        if ((it != m_latencies.end()) && (it->second.samples.size() >= latencyMinSamples))
+        {
+            std::vector<long> tmp = it->second.samples;
+
+            size_t n = (size_t)((policy.percentile() / 100.0) * (double)tmp.size());
+            if (n >= tmp.size()) { n = tmp.size() - 1; }
+
+            std::nth_element(tmp.begin(), tmp.begin() + n, tmp.end());
+            return tmp[n];
+        }
+    }
+
+    return policy.delay();
+}
+
+/**
+ * Takes a hedge token.
+ *
+ * @return `true` if a duplicate may be issued
+ */
+template <class Policy>
+bool curl::BasicThreadSharedData<Policy>::hedgeAllow()
+{
+    lock_guard lg(m_mtx);
+
+    if (m_hedgeTokens < 1) { return false; }
+
+    m_hedgeTokens -= 1;
+    ++m_stats.hedged;
+    return true;
+}
+
+/**
+ * Called once per performed request, earns the hedge tokens.
+ *
+ * @param latency_ms Total time of the transfer, -1 if it failed
+ */
+template <class Policy>
+void curl::BasicThreadSharedData<Policy>::reportLatency(const std::string& host, long latency_ms)
+{
+    lock_guard lg(m_mtx);
+
+    m_hedgeTokens += m_hedgeRatio;
+    if (m_hedgeTokens > m_hedgeBurst) { m_hedgeTokens = m_hedgeBurst; }
+
+    if (latency_ms < 0) { return; }
+
+    Latencies& l = m_latencies[host];
+
+    if (l.samples.size() < latencyWindow) { l.samples.push_back(latency_ms); }
+    else
+    {
+        l.samples[l.next] = latency_ms;
+        l.next = (l.next + 1) % latencyWindow;
+    }
+}
+
+/**
+ * @return The IDs of the other requests of the batch, if `queueId` is the ID of a batch. Their responses have to be
+ * set.
+ */
+template <class Policy>
+std::vector<curl::QueueId> curl::BasicThreadSharedData<Policy>::takeBatchMembers(const QueueId& queueId)
+{
+    lock_guard lg(m_mtx);
+
+    std::vector<curl::QueueId> r;
+
+    const auto it = m_batches.find(queueId);
+    if (it != m_batches.end())
+    {
+        r.assign(it->second.begin(), it->second.end());
+        m_batches.erase(it);
+    }
+
+    return r;
+}
+
+template <class Policy>
+void curl::BasicThreadSharedData<Policy>::flushBatches()
+{
+    lock_guard lg(m_mtx);
+    for (auto it = m_batchers.begin(); it != m_batchers.end(); ++it) { m_flushBatch(it->second); }
+}
+
+template <class Policy>
+std::vector<std::string> curl::BasicThreadSharedData<Policy>::takeWarmUp()
+{
+    lock_guard lg(m_mtx);
+
+    std::vector<std::string> r;
+    r.swap(m_warmUp);
+    return r;
+}
+
+/**
+ * Sleeps up to `timeout_us`, returns early if a request has been queued, a response has been popped or any other
+ * change which the worker has to handle happened since the last call.
+ */
+template <class Policy>
+void curl::BasicThreadSharedData<Policy>::waitForWork(int timeout_us)
+{
+    std::unique_lock<std::mutex> lock(m_mtx);
+
+    if (m_sharded.load(std::memory_order_relaxed))
+    {
+        // pairs with the fence in `m_submit()`, either the worker sees the submitted request or the producer sees the
+        // worker waiting and wakes it up
+        m_workerWaiting.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (m_shardPending.load(std::memory_order_relaxed) != 0) { m_wake = true; }
+    }
+
+    if (!m_wake && (timeout_us > 0)) { m_workCv.wait_for(lock, std::chrono::microseconds(timeout_us), [this]() { return m_wake; }); }
+    m_wake = false;
+    m_workerWaiting.store(false, std::memory_order_relaxed);
+}
+
+/**
+ * Called by `curl::CompletionQueue` for the drained completions.
+ */
+template <class Policy>
+void curl::BasicThreadSharedData<Policy>::releaseCompletions(const std::vector<curl::Completion>& completions)
+{
+    if (completions.empty()) { return; }
+
+    lock_guard lg(m_mtx);
+
+    for (size_t i = 0; i < completions.size(); ++i)
+    {
+        const curl::QueueId::id_type id = completions[i].queueId();
+
+        curl::trace::record(curl::trace::Event::popped, id);
+        m_routes.erase(id);
+        m_release(id);
+    }
+}
+
+/**
+ * The queue ID of the request stays reserved while it's delayed.
+ *
+ * @return `false` if the request has been cancelled while in flight, it's not retried and its queue ID is released
+ */
+template <class Policy>
+bool curl::BasicThreadSharedData<Policy>::delayRequest(const BasicThreadSharedData::Request& req, long delay_ms)
+{
+    lock_guard lg(m_mtx);
+
+    if (m_inFlight == req.queueId()) { m_inFlight = QueueId::NONE; }
+
+    const auto itCancelled = std::find(m_cancelled.begin(), m_cancelled.end(), req.queueId());
+    if (itCancelled != m_cancelled.end())
+    {
+        m_cancelled.erase(itCancelled);
+        m_routes.erase(req.queueId());
+        m_release(req.queueId());
+        return false;
+    }
+
+    m_advanceTimers();
+    ++m_stats.retried;
+
+    Delayed& d = m_qDelayed[req.queueId()];
+    d.request = req;
+    d.timerSeq = m_insertTimer(req.queueId(), m_timer.now() + delay_ms);
+    m_publishCounts();
+
+    return true;
+}
+
+/**
+ * Called before a request is performed. If it returns `false`, the request has to fail without touching the network.
+ */
+template <class Policy>
+bool curl::BasicThreadSharedData<Policy>::circuitAllow(const std::string& host)
+{
+    lock_guard lg(m_mtx);
+
+    if (!m_breakerConfig.enabled()) { return true; }
+
+    bool allow = true;
+    const auto it = m_breakers.find(host);
+
+    if (it != m_breakers.end())
+    {
+        Breaker& b = it->second;
+
+        if ((b.state == CircuitState::open) && ((curl::util::steadyTime_ms() - b.openedAt_ms) >= m_breakerConfig.openDuration()))
+        {
+            b.state = CircuitState::halfOpen;
+            b.probes = 0;
+        }
+
+        if (b.state == CircuitState::open) { allow = false; }
+        else if (b.state == CircuitState::halfOpen)
+        {
+            allow = (b.probes < m_breakerConfig.halfOpenProbes());
+            if (allow) { ++(b.probes); }
+        }
+
+        if (!allow)
+        {
+            ++(b.rejected);
+            ++m_stats.rejected;
+        }
+    }
+
+    return allow;
+}
+
+/**
+ * Reports the outcome of a request which has been allowed by `circuitAllow()`.
+ */
+template <class Policy>
+void curl::BasicThreadSharedData<Policy>::circuitReport(const std::string& host, bool failed)
+{
+    lock_guard lg(m_mtx);
+
+    if (!m_breakerConfig.enabled()) { return; }
+
+    auto it = m_breakers.find(host);
+
+    if (it == m_breakers.end())
+    {
+        if (!failed) { return; } // healthy hosts don't need a breaker
+
+        Breaker tmp;
+        tmp.state = CircuitState::closed;
+        tmp.consecutiveFailures = 0;
+        tmp.windowFailures = 0;
+        tmp.probes = 0;
+        tmp.openedAt_ms = 0;
+        tmp.rejected = 0;
+        it = m_breakers.insert(std::make_pair(host, tmp)).first;
+    }
+
+    Breaker& b = it->second;
+
+    b.consecutiveFailures = (failed ? b.consecutiveFailures + 1 : 0);
+
+    b.window.push_back(failed);
+    if (failed) { ++(b.windowFailures); }
+    while ((int)b.window.size() > m_breakerConfig.window())
+    {
+        if (b.window.front()) { --(b.windowFailures); }
+        b.window.pop_front();
+    }
+
+    bool open = false;
+
+    if (b.state == CircuitState::halfOpen)
+    {
+        if (b.probes > 0) { --(b.probes); }
+        open = failed;
+
+        if (!failed)
+        {
+            b.state = CircuitState::closed;
+            b.consecutiveFailures = 0;
+            b.window.clear();
+            b.windowFailures = 0;
+        }
+    }
+    else if (b.state == CircuitState::closed)
+    {
+        const CircuitBreakerConfig& cfg = m_breakerConfig;
+
+        if ((cfg.consecutiveFailures() > 0) && (b.consecutiveFailures >= cfg.consecutiveFailures())) { open = true; }
+
+        if ((cfg.errorRate() > 0) && (cfg.window() > 0) && ((int)b.window.size() >= cfg.window()) &&
+            ((double)b.windowFailures >= (cfg.errorRate() * (double)b.window.size())))
+        {
+            open = true;
+        }
+    }
+
+    if (open)
+    {
+        b.state = CircuitState::open;
+        b.openedAt_ms = curl::util::steadyTime_ms();
+        b.probes = 0;
+    }
+}
+
+/**
+ * @return Time in ms until the next timer can expire or a throttled request can be dispatched at the earliest, or -1
+ * if there is nothing to wait for
+ */
+template <class Policy>
+long curl::BasicThreadSharedData<Policy>::timeToNextTimer()
+{
+    lock_guard lg(m_mtx);
+
+    m_advanceTimers();
+
+    long t = (long)m_timer.nextExpiry();
+    if ((m_throttleWait_ms >= 0) && ((t < 0) || (m_throttleWait_ms < t))) { t = m_throttleWait_ms; }
+
+    return t;
+}
+
+
+
+curl::CompletionQueue::CompletionQueue(const std::function<void(const std::vector<curl::Completion>&)>& release)
+    : m_release(release), m_mtx(), m_cv(), m_items()
+{
+    m_notifyFd[0] = -1;
+    m_notifyFd[1] = -1;
+}
+
+curl::CompletionQueue::~CompletionQueue()
+{
+#if !defined(_WIN32)
+    if (m_notifyFd[0] >= 0) { close(m_notifyFd[0]); }
+    if ((m_notifyFd[1] >= 0) && (m_notifyFd[1] != m_notifyFd[0])) { close(m_notifyFd[1]); }
+#endif
+}
+
+bool curl::CompletionQueue::empty() const
+{
+    std::lock_guard<std::mutex> lg(m_mtx);
+    return m_items.empty();
+}
+
+size_t curl::CompletionQueue::size() const
+{
+    std::lock_guard<std::mutex> lg(m_mtx);
+    return m_items.size();
+}
+
+std::vector<curl::Completion> curl::CompletionQueue::drain()
+{
+    std::vector<curl::Completion> completions;
+
+    {
+        std::lock_guard<std::mutex> lg(m_mtx);
+        completions = m_take();
+    }
+
+    m_release(completions);
+
+    return completions;
+}
+
+std::vector<curl::Completion> curl::CompletionQueue::wait(const std::chrono::milliseconds& timeout)
+{
+    std::vector<curl::Completion> completions;
+
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        m_cv.wait_for(lock, timeout, [this]() { return !m_items.empty(); });
+        completions = m_take();
+    }
+
+    m_release(completions);
+
+    return completions;
+}
+
+/**
+ * Creates the notification descriptor on the first call. If the queue is not empty by then, it's signalled.
+ */
+int curl::CompletionQueue::fd()
+{
+    std::lock_guard<std::mutex> lg(m_mtx);
+
+    if (m_notifyFd[0] < 0)
+    {
+#if defined(_WIN32)
+        // not supported
+#elif defined(__linux__)
+        const int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        m_notifyFd[0] = fd;
+        m_notifyFd[1] = fd;
+#else
+        int fds[2];
+        if (pipe(fds) == 0)
+        {
+            for (int i = 0; i < 2; ++i)
+            {
+                fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+                fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+            }
+
+            m_notifyFd[0] = fds[0];
+            m_notifyFd[1] = fds[1];
+        }
+#endif
+
+        if (!m_items.empty()) { m_notify(); }
+    }
+
+    return m_notifyFd[0];
+}
+
+void curl::CompletionQueue::push(const curl::Completion& completion)
+{
+    std::lock_guard<std::mutex> lg(m_mtx);
+
+    m_items.push_back(completion);
+
+    if (m_items.size() == 1)
+    {
+        m_notify();
+        m_cv.notify_all();
+    }
+}
+
+/**
+ * Removes the completion of a cancelled request, the caller releases its queue ID.
+ */
+bool curl::CompletionQueue::remove(const curl::QueueId& queueId)
+{
+    std::lock_guard<std::mutex> lg(m_mtx);
+
+    for (size_t i = 0; i < m_items.size(); ++i)
+    {
+        if (m_items[i].queueId() == queueId)
+        {
+            m_items.erase(m_items.begin() + i);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Takes all items and resets the fd, the lock has to be held.
+ */
+std::vector<curl::Completion> curl::CompletionQueue::m_take()
+{
+    std::vector<curl::Completion> items;
+    items.swap(m_items);
+
+#if !defined(_WIN32)
+    if (m_notifyFd[0] >= 0)
+    {
+        uint64_t buffer[16];
+        while (read(m_notifyFd[0], buffer, sizeof(buffer)) > 0) {}
+    }
+#endif
+
+    return items;
+}
+
+/**
+ * Signals the fd, if it has been created. The lock has to be held.
+ */
+void curl::CompletionQueue::m_notify()
+{
+#if !defined(_WIN32)
+    if (m_notifyFd[1] >= 0)
+    {
+        // an eventfd requires 8 bytes, for a pipe any data is fine, and a full pipe is readable anyway
+        const uint64_t one = 1;
+        const ssize_t r = write(m_notifyFd[1], &one, sizeof(one));
+        (void)r;
+    }
+#endif
+}
+
+
+
+std::string curl::toString(const Method& method)
+{
+    std::string str;
+
+    switch (method)
+    {
+    case curl::Method::GET:
+        str = "GET";
+        break;
+
+    case curl::Method::POST:
+        str = "POST";
+        break;
+
+    case curl::Method::PUT:
+        str = "PUT";
+        break;
+
+    case curl::Method::PATCH:
+        str = "PATCH";
+        break;
+
+    case curl::Method::DELETE:
+        str = "DELETE";
+        break;
+
+    case curl::Method::HEAD:
+        str = "HEAD";
+        break;
+    }
+
+    return str;
+}
+
+std::string curl::toString(const Priority& priority)
+{
+    std::string str;
+
+    switch (priority)
+    {
+    case curl::Priority::normal:
+        str = "normal";
+        break;
+
+    case curl::Priority::high:
+        str = "high";
+        break;
+
+    case curl::Priority::max:
+        str = "max";
+        break;
+    }
+
+    return str;
+}
+
+std::string curl::toString(const CircuitState& state)
+{
+    std::string str;
+
+    switch (state)
+    {
+    case curl::CircuitState::closed:
+        str = "closed";
+        break;
+
+    case curl::CircuitState::open:
+        str = "open";
+        break;
+
+    case curl::CircuitState::halfOpen:
+        str = "half open";
+        break;
+    }
+
+    return str;
+}
+
+int curl::random(int min, int max)
+{
+    std::random_device rd;
+    std::mt19937 gen(rd());
+
+    static_assert(sizeof(int) == sizeof(int32_t), "types might need to be changed here");
+    std::uniform_int_distribution<int32_t> distrib(0, INT32_MAX);
+    auto rand_i32 = [&gen, &distrib]() { return distrib(gen); };
+
+    const int span = (max - min) + 1;
+
+    return ((span > 0) ? (min + (((int)rand_i32()) % span)) : min);
+}
+
+
+
+template class curl::BasicThreadSharedData<curl::ThreadQueuePolicy>;
+template class curl::BasicThreadSharedData<curl::DebugQueuePolicy>;
+
+
+
+// curl.h implementation
+//======================================================================================================================
+// types.h implementation
+
+
+
+std::string curl::QueueId::toString() const
+{
+    std::string str;
+
+    switch (m_id)
+    {
+    case NONE:
+        str = "NONE (" + std::to_string(m_id) + ")";
+        break;
 
-            switch (priority)
-            {
-            case Priority::normal:
-                m_qNormal.push(tmp);
-                break;
+    case FAILED:
+        str = "FAILED (" + std::to_string(m_id) + ")";
+        break;
 
-            case Priority::high:
-                m_qHigh.push(tmp);
-                break;
+    case OVER_BUDGET:
+        str = "OVER_BUDGET (" + std::to_string(m_id) + ")";
+        break;
 
-            case Priority::max:
-                m_qMax.push(tmp);
-                break;
-            }
-        }
-        catch (...)
-        {
-            m_rmQueueId(id);
-            id = QueueId::FAILED;
-        }
+    default:
+        str = std::to_string(m_id);
+        break;
     }
 
-    DEBUG_print_queueId_vector_after();
-
-    return id;
+    return str;
 }
 
-curl::Response curl::ThreadSharedData::popResponse()
+
+
+
+
+#define ___curl_HeaderField_delimiter (": ")
+const char* const curl::HeaderField::delimiter = ___curl_HeaderField_delimiter;
+
+std::string curl::HeaderField::value() const
 {
-    lock_guard lg(m_mtx);
-    m_rmQueueId(m_response.queueId());
-    const curl::Response res = m_response;
-    m_response.clear();
-    return res;
+    CONSTEXPR size_t delimiterLength = curl::util::strlen(___curl_HeaderField_delimiter);
+    return m_curlStr.substr(m_keySize + delimiterLength);
 }
 
-/**
- * Removes the `id` from `m_queueId`. If `id` is not found `m_queueId` is unchanged.
- */
-void curl::ThreadSharedData::m_rmQueueId(curl::QueueId::id_type id)
+curl::StringView curl::HeaderField::valueView() const
 {
-    DEBUG_print_queueId_vector_before();
+    CONSTEXPR size_t delimiterLength = curl::util::strlen(___curl_HeaderField_delimiter);
+    return StringView(m_curlStr.data() + m_keySize + delimiterLength, m_curlStr.size() - m_keySize - delimiterLength);
+}
+
 
-    for (size_t i = 0; i < m_queueId.size(); ++i)
-    {
-        if (m_queueId[i] == id)
-        {
-            m_queueId.erase(m_queueId.begin() + i);
-            --i;
-        }
-    }
 
-    DEBUG_print_queueId_vector_after();
+bool curl::StringView::operator==(const StringView& other) const
+{
+    return ((m_size == other.m_size) && ((m_size == 0) || (std::memcmp(m_data, other.m_data, m_size) == 0)));
 }
 
-/**
- * Returnes an unused ID in range [`curl::QueueId::BASE`, `curl::QueueId::MAX`] or `curl::QueueId::FAILED`.
- */
-curl::QueueId curl::ThreadSharedData::m_getNewQueueId()
+bool curl::StringView::equalsIgnoreCase(const StringView& other) const
 {
-    static_assert((curl::QueueId::BASE > 0) &&                             // see curl::QueueId::isValid()
-                      (curl::QueueId::MAX <= INT16_MAX) &&                 // the latter two ensure that the doc of this
-                      (sizeof(curl::QueueId::id_type) >= sizeof(int16_t)), // func is true on all possible platormfms
-                  "see comments");
+    bool eq = (m_size == other.m_size);
+
+    for (size_t i = 0; (i < m_size) && eq; ++i)
+    {
+        char a = m_data[i];
+        char b = other.m_data[i];
+        if ((a >= 'A') && (a <= 'Z')) { a = (char)(a - 'A' + 'a'); }
+        if ((b >= 'A') && (b <= 'Z')) { b = (char)(b - 'A' + 'a'); }
+        eq = (a == b);
+    }
 
+    return eq;
+}
 
-    curl::QueueId::id_type id = curl::QueueId::BASE;
-    bool used;
 
-    do {
-        used = false;
 
-        for (size_t i = 0; (i < m_queueId.size()) && !used; ++i)
+curl::HeaderSet::HeaderSet(const std::vector<HeaderField>& fields)
+    : m_fields(fields), m_list(nullptr)
+{
+    for (size_t i = 0; i < m_fields.size(); ++i)
+    {
+        if (!m_fields[i].empty())
         {
-            if (m_queueId[i] == id)
+            curl_slist* const tmp = curl_slist_append(m_list, m_fields[i].curlStr());
+
+            if (!tmp)
             {
-                if (id < curl::QueueId::MAX)
-                {
-                    used = true;
-                    ++id;
-                }
-                else
-                {
-                    id = curl::QueueId::FAILED;
-                    used = false;
-                }
+                // perform() falls back to building the list on every transfer
+                curl_slist_free_all(m_list);
+                m_list = nullptr;
+                break;
             }
+
+            m_list = tmp;
         }
     }
-    while (used);
+}
 
-    // if ((id > 100) || (id < 0)) { LOG_WRN("new queue ID: %i", id); }
+curl::HeaderSet::~HeaderSet() { curl_slist_free_all(m_list); }
 
-    return id;
+const curl::HeaderField* curl::HeaderSet::find(const StringView& key) const
+{
+    for (size_t i = 0; i < m_fields.size(); ++i)
+    {
+        if (m_fields[i].keyView().equalsIgnoreCase(key)) { return &m_fields[i]; }
+    }
+
+    return nullptr;
 }
 
-curl::ThreadSharedData::Request curl::ThreadSharedData::popRequest()
+
+
+int curl::ResponseHeaders::indexOf(const StringView& key) const
 {
-    lock_guard lg(m_mtx);
+    const uint32_t hash = m_hash(key);
+
+    for (size_t i = 0; i < m_index.size(); ++i)
+    {
+        if ((m_index[i].hash == hash) && this->key(i).equalsIgnoreCase(key)) { return (int)i; }
+    }
+
+    return -1;
+}
 
-    curl::ThreadSharedData::Request r;
+curl::StringView curl::ResponseHeaders::find(const StringView& key) const
+{
+    const int i = indexOf(key);
+    return ((i >= 0) ? value((size_t)i) : StringView());
+}
+
+void curl::ResponseHeaders::clear()
+{
+    m_buffer.clear();
+    m_index.clear();
+}
+
+void curl::ResponseHeaders::parseLine(const char* p, size_t size)
+{
+    auto isWhitespace = [](char c) { return ((c == ' ') || (c == '\t') || (c == '\r') || (c == '\n')); };
+
+    if ((size >= 5) && (std::memcmp(p, "HTTP/", 5) == 0))
+    {
+        clear();
+        return;
+    }
 
-    if (!m_qMax.empty())
+    size_t end = size;
+    while ((end > 0) && isWhitespace(p[end - 1])) { --end; }
+    if (end == 0) { return; }
+
+    if (((p[0] == ' ') || (p[0] == '\t')) && !m_index.empty())
     {
-        r = m_qMax.front();
-        m_qMax.pop();
+        // obsolete line folding, the continuation is appended to the previous value, which is at the end of the buffer
+        size_t begin = 0;
+        while (isWhitespace(p[begin])) { ++begin; }
+
+        m_buffer.push_back(' ');
+        m_buffer.append(p + begin, end - begin);
+        m_index.back().valueSize = (uint32_t)(m_buffer.size() - m_index.back().value);
+        return;
     }
-    else if (!m_qHigh.empty())
+
+    const char* const colon = (const char*)std::memchr(p, ':', end);
+    if (!colon || (colon == p)) { return; }
+
+    size_t keySize = (size_t)(colon - p);
+    while ((keySize > 0) && isWhitespace(p[keySize - 1])) { --keySize; }
+
+    size_t valueBegin = (size_t)(colon - p) + 1;
+    while ((valueBegin < end) && isWhitespace(p[valueBegin])) { ++valueBegin; }
+
+    Entry e;
+    e.key = (uint32_t)m_buffer.size();
+    e.keySize = (uint32_t)keySize;
+    m_buffer.append(p, keySize);
+    e.value = (uint32_t)m_buffer.size();
+    e.valueSize = (uint32_t)(end - valueBegin);
+    m_buffer.append(p + valueBegin, end - valueBegin);
+    e.hash = m_hash(StringView(p, keySize));
+
+    m_index.push_back(e);
+}
+
+/**
+ * FNV-1a of the lower case key.
+ */
+uint32_t curl::ResponseHeaders::m_hash(const StringView& key)
+{
+    uint32_t h = 2166136261u;
+
+    for (size_t i = 0; i < key.size(); ++i)
     {
-        r = m_qHigh.front();
-        m_qHigh.pop();
+        char c = key.data()[i];
+        if ((c >= 'A') && (c <= 'Z')) { c = (char)(c - 'A' + 'a'); }
+        h = (h ^ (uint8_t)c) * 16777619u;
     }
-    else if (!m_qNormal.empty())
+
+    return h;
+}
+
+
+
+curl::RetryPolicy::RetryPolicy(int maxAttempts, long baseDelay_ms, long maxDelay_ms)
+    : m_maxAttempts(maxAttempts),
+      m_baseDelay_ms(baseDelay_ms),
+      m_maxDelay_ms(maxDelay_ms),
+      m_jitter(50),
+      m_retryAfter(true),
+      m_curlCodes({ CURLE_COULDNT_CONNECT, CURLE_OPERATION_TIMEDOUT, CURLE_SEND_ERROR, CURLE_RECV_ERROR, CURLE_GOT_NOTHING, CURLE_PARTIAL_FILE }),
+      m_httpCodes({ 408, 429, 500, 502, 503, 504 })
+{}
+
+bool curl::RetryPolicy::retryable(int curlCode, int httpCode) const
+{
+    bool r = false;
+
+    for (size_t i = 0; (i < m_curlCodes.size()) && !r; ++i) { r = (curlCode == m_curlCodes[i]); }
+
+    if (curlCode == CURLE_OK)
     {
-        r = m_qNormal.front();
-        m_qNormal.pop();
+        for (size_t i = 0; (i < m_httpCodes.size()) && !r; ++i) { r = (httpCode == m_httpCodes[i]); }
     }
-    else { r.clear(); }
 
     return r;
 }
 
+long curl::RetryPolicy::delay(int attempt) const
+{
+    long d = m_baseDelay_ms;
+    for (int i = 1; (i < attempt) && (d < m_maxDelay_ms); ++i) { d *= 2; }
+    if (d > m_maxDelay_ms) { d = m_maxDelay_ms; }
 
+    if ((m_jitter > 0) && (d > 0))
+    {
+        const long maxJitter = (long)((int64_t)d * (m_jitter > 100 ? 100 : m_jitter) / 100);
+        d -= (long)curl::random(0, (int)(maxJitter < INT32_MAX ? maxJitter : INT32_MAX));
+    }
 
-std::string curl::toString(const Method& method)
+    return d;
+}
+
+
+
+size_t curl::ByteBudget::limit(const Priority& priority) const
 {
-    std::string str;
+    size_t limit = 0;
 
-    switch (method)
+    switch (priority)
     {
-    case curl::Method::GET:
-        str = "GET";
+    case curl::Priority::normal:
+        limit = m_normal;
         break;
 
-    case curl::Method::POST:
-        str = "POST";
+    case curl::Priority::high:
+        limit = m_high;
+        break;
+
+    case curl::Priority::max:
+        limit = m_max;
         break;
     }
 
-    return str;
+    return limit;
 }
 
-std::string curl::toString(const Priority& priority)
+void curl::ByteBudget::setLimit(const Priority& priority, size_t limit)
 {
-    std::string str;
-
     switch (priority)
     {
     case curl::Priority::normal:
-        str = "normal";
+        m_normal = limit;
         break;
 
     case curl::Priority::high:
-        str = "high";
+        m_high = limit;
         break;
 
     case curl::Priority::max:
-        str = "max";
+        m_max = limit;
         break;
     }
-
-    return str;
 }
 
-int curl::random(int min, int max)
+
+
+size_t curl::ShedConfig::reserve(const Priority& priority) const
 {
-    std::random_device rd;
-    std::mt19937 gen(rd());
+    size_t n = 0;
 
-    static_assert(sizeof(int) == sizeof(int32_t), "types might need to be changed here");
-    std::uniform_int_distribution<int32_t> distrib(0, INT32_MAX);
-    auto rand_i32 = [&gen, &distrib]() { return distrib(gen); };
+    switch (priority)
+    {
+    case curl::Priority::normal:
+        n = 0;
+        break;
 
-    const int span = (max - min) + 1;
+    case curl::Priority::high:
+        n = m_reserveHigh;
+        break;
 
-    return ((span > 0) ? (min + (((int)rand_i32()) % span)) : min);
+    case curl::Priority::max:
+        n = m_reserveMax;
+        break;
+    }
+
+    return n;
 }
 
+void curl::ShedConfig::setReserve(const Priority& priority, size_t n)
+{
+    switch (priority)
+    {
+    case curl::Priority::normal:
+        break;
+
+    case curl::Priority::high:
+        m_reserveHigh = n;
+        break;
 
+    case curl::Priority::max:
+        m_reserveMax = n;
+        break;
+    }
+}
 
-// curl.h implementation
-//======================================================================================================================
-// types.h implementation
+size_t curl::ShedConfig::limit(const Priority& priority) const
+{
+    // the reserves of the higher priorities are not available
+    size_t reserved = 0;
+    if (priority == Priority::normal) { reserved = m_reserveHigh + m_reserveMax; }
+    else if (priority == Priority::high) { reserved = m_reserveMax; }
 
+    return ((m_capacity > reserved) ? (m_capacity - reserved) : 0);
+}
 
 
-std::string curl::QueueId::toString() const
-{
-    std::string str;
 
-    switch (m_id)
+curl::BatchConfig::BatchConfig(size_t maxItems, long maxDelay_ms, BatchFraming framing)
+    : m_maxItems(maxItems),
+      m_maxDelay_ms(maxDelay_ms),
+      m_maxItemSize(4 * 1024),
+      m_maxBytes(64 * 1024),
+      m_framing(framing),
+      m_prefix(),
+      m_separator(),
+      m_suffix(),
+      m_contentType()
+{
+    switch (framing)
     {
-    case NONE:
-        str = "NONE (" + std::to_string(m_id) + ")";
+    case BatchFraming::ndjson:
+        m_separator = "\n";
+        m_suffix = "\n";
+        m_contentType = "application/x-ndjson";
         break;
 
-    case FAILED:
-        str = "FAILED (" + std::to_string(m_id) + ")";
+    case BatchFraming::jsonArray:
+        m_prefix = "[";
+        m_separator = ",";
+        m_suffix = "]";
+        m_contentType = "application/json";
         break;
 
-    default:
-        str = std::to_string(m_id);
+    case BatchFraming::custom:
         break;
     }
+}
 
-    return str;
+void curl::BatchConfig::setJoiner(const std::string& prefix, const std::string& separator, const std::string& suffix, const std::string& contentType)
+{
+    m_framing = BatchFraming::custom;
+    m_prefix = prefix;
+    m_separator = separator;
+    m_suffix = suffix;
+    m_contentType = contentType;
 }
 
+std::string curl::BatchConfig::join(const std::vector<const std::string*>& bodies) const
+{
+    size_t size = m_prefix.size() + m_suffix.size();
+    for (size_t i = 0; i < bodies.size(); ++i) { size += bodies[i]->size() + m_separator.size(); }
 
+    std::string r;
+    r.reserve(size);
 
+    r += m_prefix;
 
+    for (size_t i = 0; i < bodies.size(); ++i)
+    {
+        if (i > 0) { r += m_separator; }
+        r += *bodies[i];
+    }
 
-#define ___curl_HeaderField_delimiter (": ")
-const char* const curl::HeaderField::delimiter = ___curl_HeaderField_delimiter;
+    r += m_suffix;
+
+    return r;
+}
 
-std::string curl::HeaderField::key() const
+
+
+const char* const curl::Request::defaultUserAgent = "libcurl";
+
+curl::MappedFile::MappedFile(const std::string& filename, bool removeOnClose)
+    : m_filename(filename),
+      m_removeOnClose(removeOnClose),
+      m_valid(false),
+      m_data(nullptr),
+      m_size(0)
+#ifdef _WIN32
+      ,
+      m_hFile(INVALID_HANDLE_VALUE),
+      m_hMapping(nullptr)
+#endif
 {
-    const size_t delimiterPos = m_curlStr.find(delimiter);
-    return m_curlStr.substr(0, delimiterPos);
+#ifdef _WIN32
+
+    // a file opened with FILE_FLAG_DELETE_ON_CLOSE is removed when the handle is closed
+    const DWORD flags = FILE_ATTRIBUTE_NORMAL | (removeOnClose ? FILE_FLAG_DELETE_ON_CLOSE : 0);
+    const HANDLE hFile = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, flags, nullptr);
+
+    if (hFile != INVALID_HANDLE_VALUE)
+    {
+        m_hFile = hFile;
+
+        LARGE_INTEGER size;
+        if (GetFileSizeEx(hFile, &size))
+        {
+            if (size.QuadPart == 0)
+            {
+                m_data = "";
+                m_valid = true;
+            }
+            else
+            {
+                const HANDLE hMapping = CreateFileMappingA(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+                if (hMapping)
+                {
+                    const void* const p = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+
+                    if (p)
+                    {
+                        m_hMapping = hMapping;
+                        m_data = static_cast<const char*>(p);
+                        m_size = (size_t)size.QuadPart;
+                        m_valid = true;
+                    }
+                    else { CloseHandle(hMapping); }
+                }
+            }
+        }
+    }
+    else if (removeOnClose) { DeleteFileA(filename.c_str()); }
+
+#else
+
+    const int fd = open(filename.c_str(), O_RDONLY);
+
+    if (fd >= 0)
+    {
+        struct stat st;
+        if (fstat(fd, &st) == 0)
+        {
+            if (st.st_size == 0)
+            {
+                m_data = "";
+                m_valid = true;
+            }
+            else
+            {
+                void* const p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+                if (p != MAP_FAILED)
+                {
+                    m_data = static_cast<const char*>(p);
+                    m_size = (size_t)st.st_size;
+                    m_valid = true;
+                }
+            }
+        }
+
+        close(fd); // the mapping stays valid
+    }
+
+    // the data stays accessible through the mapping
+    if (removeOnClose) { unlink(filename.c_str()); }
+
+#endif
 }
 
-std::string curl::HeaderField::value() const
+curl::MappedFile::~MappedFile()
 {
-    const size_t delimiterPos = m_curlStr.find(delimiter);
-    CONSTEXPR size_t delimiterLength = curl::util::strlen(___curl_HeaderField_delimiter);
-    return m_curlStr.substr(delimiterPos + delimiterLength);
+#ifdef _WIN32
+    if (m_hMapping)
+    {
+        UnmapViewOfFile(m_data);
+        CloseHandle(m_hMapping);
+    }
+    if (m_hFile != INVALID_HANDLE_VALUE) { CloseHandle(m_hFile); }
+#else
+    if (m_size > 0) { munmap(const_cast<char*>(m_data), m_size); }
+#endif
 }
 
 
 
-const char* const curl::Request::defaultUserAgent = "libcurl";
+const size_t curl::UploadSource::abortTransfer = CURL_READFUNC_ABORT;
+
+
+
+curl::SharedString curl::intern(const std::string& str)
+{
+    // most requests use the default user agent, it doesn't need the lookup
+    static const curl::SharedString defaultUA = internPool().get(curl::Request::defaultUserAgent);
+    if (str == curl::Request::defaultUserAgent) { return defaultUA; }
+
+    return internPool().get(str);
+}
 
 std::string curl::Request::toString() const
 {
     std::string str = curl::toString(m_method);
 
-    str += " " + m_url;
+    str += " " + url();
     str += " " + std::to_string(m_connectTimeout);
     str += " " + std::to_string(m_totalTimeout);
-    str += " \"" + m_userAgent + "\"";
+    str += " \"" + userAgent() + "\"";
     // str += " (" + std::to_string(m_queueId) + ")";
 
     if (!m_body.empty()) { str += " " + m_body; }
@@ -610,7 +4217,12 @@ std::string curl::Response::toString_noBody() const
 {
     std::string str = std::to_string(m_curlCode);
 
-    if (m_curlCode != CURLE_OK) { str += " " + std::string(curl_easy_strerror((CURLcode)m_curlCode)); }
+    if (m_curlCode == E_CIRCUIT_OPEN) { str += " circuit breaker open"; }
+    else if (m_curlCode == E_SHED) { str += " shed"; }
+    else if (m_curlCode == E_FILE) { str += " file error"; }
+    else if (m_curlCode == E_NOT_QUEUED) { str += " not queued"; }
+    else if (m_curlCode == E_SHUTDOWN) { str += " shutdown"; }
+    else if (m_curlCode != CURLE_OK) { str += " " + std::string(curl_easy_strerror((CURLcode)m_curlCode)); }
 
     str += " - " + std::to_string(m_httpCode);
 
@@ -621,5 +4233,7 @@ void curl::Response::m_clear()
 {
     m_curlCode = (-1);
     m_httpCode = (-1);
-    m_body = std::string();
+    m_body.clear(); // keeps the buffer, see `curl::BasicThreadSharedData::popResponse(curl::Response&)`
+    m_headers.clear();
+    m_file.reset();
 }
@@ -0,0 +1,652 @@
+/*
+author          Oliver Blaser
+date            18.10.2026
+copyright       MIT - Copyright (c) 2026 Oliver Blaser
+*/
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../include/curl-thread/spool.h"
+#include "../include/curl-thread/types.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace {
+
+constexpr char fileMagic[8] = { 'C', 'T', 'S', 'P', 'O', 'O', 'L', '1' };
+constexpr size_t fileHeaderSize = 4096; // the ring starts page aligned
+constexpr size_t minCapacity = 4096;
+
+constexpr uint32_t recordMagic = 0x52505343; // "CSPR"
+constexpr uint32_t wrapMagic = 0x57505343;   // "CSPW", the rest of the ring is unused
+constexpr uint8_t statePending = 1;
+constexpr uint8_t stateDone = 2;
+constexpr uint8_t payloadVersion = 1;
+
+struct HeadSlot
+{
+    uint64_t offset; // of the oldest pending record
+    uint64_t seq;    // its sequence number
+    uint32_t crc;
+    uint32_t reserved;
+};
+
+struct FileHeader
+{
+    char magic[8];
+    uint64_t capacity;
+    HeadSlot slots[2];
+};
+
+struct RecordHeader
+{
+    uint32_t magic;
+    uint32_t size; // of the payload
+    uint64_t seq;
+    uint32_t crc; // of size, seq and the payload
+    uint8_t state;
+    uint8_t reserved[3];
+};
+
+static_assert(sizeof(RecordHeader) == 24, "unexpected record header size");
+static_assert(sizeof(FileHeader) <= fileHeaderSize, "file header too large");
+
+size_t align8(size_t n) { return ((n + 7) & ~(size_t)7); }
+
+uint32_t crc32Update(uint32_t crc, const void* data, size_t size)
+{
+    static const struct Table
+    {
+        uint32_t t[256];
+
+        Table()
+        {
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                uint32_t c = i;
+                for (int k = 0; k < 8; ++k) { c = ((c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1)); }
+                t[i] = c;
+            }
+        }
+    } table;
+
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; ++i) { crc = table.t[(crc ^ p[i]) & 0xFF] ^ (crc >> 8); }
+    return crc;
+}
+
+uint32_t recordCrc(uint32_t size, uint64_t seq, const char* payload)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    crc = crc32Update(crc, &size, sizeof(size));
+    crc = crc32Update(crc, &seq, sizeof(seq));
+    crc = crc32Update(crc, payload, size);
+    return (crc ^ 0xFFFFFFFF);
+}
+
+uint32_t slotCrc(const HeadSlot& slot)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    crc = crc32Update(crc, &slot.offset, sizeof(slot.offset));
+    crc = crc32Update(crc, &slot.seq, sizeof(slot.seq));
+    return (crc ^ 0xFFFFFFFF);
+}
+
+
+
+/*
+ * Payload encoding, all integers in host byte order:
+ *
+ *   u8 version, u8 method, u8 priority, u8 captureHeaders
+ *   i64 connectTimeout, i64 totalTimeout, i64 maxResponseSize
+ *   str url, str userAgent
+ *   u32 number of header fields, followed by str key, str value of each field (header set fields first)
+ *   str body
+ *
+ * `str` is a u32 length followed by the bytes.
+ */
+
+size_t encodedSize(const curl::Request& req, const std::string& url)
+{
+    size_t size = (4 * 1) + (3 * 8) + (4 + url.size()) + (4 + req.userAgent().size()) + 4 + (4 + req.body().size());
+
+    if (req.headerSet())
+    {
+        for (const curl::HeaderField& f : req.headerSet()->fields()) { size += 8 + f.keyView().size() + f.valueView().size(); }
+    }
+
+    for (const curl::HeaderField& f : req.header()) { size += 8 + f.keyView().size() + f.valueView().size(); }
+
+    return size;
+}
+
+class Writer
+{
+public:
+    explicit Writer(char* p)
+        : m_p(p)
+    {}
+
+    void u8(uint8_t value) { *(m_p++) = (char)value; }
+    void u32(uint32_t value) { m_write(&value, sizeof(value)); }
+    void i64(int64_t value) { m_write(&value, sizeof(value)); }
+
+    void str(const char* data, size_t size)
+    {
+        u32((uint32_t)size);
+        m_write(data, size);
+    }
+
+private:
+    char* m_p;
+
+    void m_write(const void* data, size_t size)
+    {
+        std::memcpy(m_p, data, size);
+        m_p += size;
+    }
+};
+
+void encode(char* p, const curl::Request& req, const std::string& url, const curl::Priority& priority)
+{
+    Writer w(p);
+
+    w.u8(payloadVersion);
+    w.u8((uint8_t)req.method());
+    w.u8((uint8_t)priority);
+    w.u8(req.captureHeaders() ? 1 : 0);
+    w.i64(req.connectTimeout());
+    w.i64(req.totalTimeout());
+    w.i64(req.maxResponseSize());
+    w.str(url.data(), url.size());
+    w.str(req.userAgent().data(), req.userAgent().size());
+
+    const size_t nSet = (req.headerSet() ? req.headerSet()->size() : 0);
+    w.u32((uint32_t)(nSet + req.header().size()));
+
+    for (size_t i = 0; i < nSet; ++i)
+    {
+        const curl::HeaderField& f = (*req.headerSet())[i];
+        w.str(f.keyView().data(), f.keyView().size());
+        w.str(f.valueView().data(), f.valueView().size());
+    }
+
+    for (const curl::HeaderField& f : req.header())
+    {
+        w.str(f.keyView().data(), f.keyView().size());
+        w.str(f.valueView().data(), f.valueView().size());
+    }
+
+    w.str(req.body().data(), req.body().size());
+}
+
+class Reader
+{
+public:
+    Reader(const char* p, size_t size)
+        : m_p(p), m_end(p + size), m_ok(true)
+    {}
+
+    bool ok() const { return m_ok; }
+    bool atEnd() const { return (m_p == m_end); }
+
+    uint8_t u8()
+    {
+        uint8_t value = 0;
+        m_read(&value, sizeof(value));
+        return value;
+    }
+
+    uint32_t u32()
+    {
+        uint32_t value = 0;
+        m_read(&value, sizeof(value));
+        return value;
+    }
+
+    int64_t i64()
+    {
+        int64_t value = 0;
+        m_read(&value, sizeof(value));
+        return value;
+    }
+
+    std::string str()
+    {
+        const uint32_t size = u32();
+        if (!m_ok || ((size_t)(m_end - m_p) < size))
+        {
+            m_ok = false;
+            return std::string();
+        }
+
+        const std::string value(m_p, size);
+        m_p += size;
+        return value;
+    }
+
+private:
+    const char* m_p;
+    const char* m_end;
+    bool m_ok;
+
+    void m_read(void* value, size_t size)
+    {
+        if (m_ok && ((size_t)(m_end - m_p) >= size))
+        {
+            std::memcpy(value, m_p, size);
+            m_p += size;
+        }
+        else { m_ok = false; }
+    }
+};
+
+/**
+ * @return `false` if the payload is malformed or has an unknown version
+ */
+bool decode(const char* p, size_t size, uint64_t seq, std::vector<curl::Spool::Record>* records)
+{
+    Reader r(p, size);
+
+    if (r.u8() != payloadVersion) { return false; }
+
+    const uint8_t method = r.u8();
+    const uint8_t priority = r.u8();
+    const bool captureHeaders = (r.u8() != 0);
+    const int64_t connectTimeout = r.i64();
+    const int64_t totalTimeout = r.i64();
+    const int64_t maxResponseSize = r.i64();
+    const std::string url = r.str();
+    const std::string userAgent = r.str();
+
+    std::vector<curl::HeaderField> header;
+    const uint32_t nFields = r.u32();
+
+    for (uint32_t i = 0; (i < nFields) && r.ok(); ++i)
+    {
+        const std::string key = r.str();
+        const std::string value = r.str();
+        header.push_back(curl::HeaderField(key, value));
+    }
+
+    const std::string body = r.str();
+
+    if (!r.ok() || !r.atEnd() || (method > (uint8_t)curl::Method::HEAD) || (priority > (uint8_t)curl::Priority::max)) { return false; }
+
+    curl::Request req((curl::Method)method, url, (long)connectTimeout, (long)totalTimeout, userAgent);
+    req.setHeader(header);
+    req.setBody(body);
+    req.setCaptureHeaders(captureHeaders);
+    req.setMaxResponseSize(maxResponseSize);
+
+    records->push_back(curl::Spool::Record{ seq, req, (curl::Priority)priority });
+
+    return true;
+}
+
+} // namespace
+
+
+
+curl::Spool::Spool()
+    : m_filename(), m_fd(-1), m_map(nullptr), m_mapSize(0), m_ring(nullptr), m_capacity(0), m_tail(0), m_nextSeq(1), m_live(), m_headWrites(0),
+      m_commitInterval_ms(0), m_dirty(false), m_stop(false), m_commits(0), m_commitCv(), m_commitThread()
+{}
+
+curl::Spool::~Spool() { close(); }
+
+bool curl::Spool::open(const std::string& filename, size_t capacity, long commitInterval_ms, std::vector<Spool::Record>* pending)
+{
+    close();
+
+#ifdef _WIN32
+    (void)filename;
+    (void)capacity;
+    (void)commitInterval_ms;
+    (void)pending;
+    return false;
+#else
+    lock_guard lg(m_mtx);
+
+    const int fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) { return false; }
+
+    // the spool is owned by one process at a time
+    struct stat st;
+    if ((flock(fd, LOCK_EX | LOCK_NB) != 0) || (fstat(fd, &st) != 0))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    const bool created = (st.st_size == 0);
+
+    if (created)
+    {
+        m_capacity = align8(capacity < minCapacity ? minCapacity : capacity);
+        m_mapSize = fileHeaderSize + m_capacity;
+
+        // the blocks are allocated up front, writing to a hole of a full file system would raise SIGBUS
+#if defined(__linux__)
+        const bool allocated = (posix_fallocate(fd, 0, (off_t)m_mapSize) == 0);
+#else
+        const bool allocated = (ftruncate(fd, (off_t)m_mapSize) == 0);
+#endif
+
+        if (!allocated)
+        {
+            ::close(fd);
+            return false;
+        }
+    }
+    else
+    {
+        FileHeader fh;
+        const bool valid = ((pread(fd, &fh, sizeof(fh), 0) == (ssize_t)sizeof(fh)) && (std::memcmp(fh.magic, fileMagic, sizeof(fileMagic)) == 0) &&
+                            (fh.capacity >= minCapacity) && ((fh.capacity % 8) == 0) && ((uint64_t)st.st_size >= (fileHeaderSize + fh.capacity)));
+
+        if (!valid)
+        {
+            ::close(fd);
+            return false;
+        }
+
+        m_capacity = (size_t)fh.capacity;
+        m_mapSize = fileHeaderSize + m_capacity;
+    }
+
+    void* const map = mmap(nullptr, m_mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (map == MAP_FAILED)
+    {
+        ::close(fd);
+        m_mapSize = 0;
+        m_capacity = 0;
+        return false;
+    }
+
+    m_filename = filename;
+    m_fd = fd;
+    m_map = static_cast<char*>(map);
+    m_ring = m_map + fileHeaderSize;
+    m_tail = 0;
+    m_nextSeq = 1;
+    m_live.clear();
+    m_headWrites = 0;
+    m_commitInterval_ms = (commitInterval_ms > 0 ? commitInterval_ms : 0);
+    m_dirty = false;
+    m_stop = false;
+
+    if (created)
+    {
+        FileHeader fh;
+        std::memset(&fh, 0, sizeof(fh));
+        std::memcpy(fh.magic, fileMagic, sizeof(fileMagic));
+        fh.capacity = m_capacity;
+        std::memcpy(m_map, &fh, sizeof(fh));
+        m_writeHead();
+        msync(m_map, m_mapSize, MS_SYNC);
+    }
+
+    if (!m_recover(pending))
+    {
+        munmap(m_map, m_mapSize);
+        ::close(m_fd);
+        m_filename.clear();
+        m_fd = -1;
+        m_map = nullptr;
+        m_mapSize = 0;
+        m_ring = nullptr;
+        m_capacity = 0;
+        return false;
+    }
+
+    m_commitThread = std::thread(&Spool::m_commitLoop, this);
+
+    return true;
+#endif
+}
+
+void curl::Spool::close()
+{
+    {
+        lock_guard lg(m_mtx);
+        m_stop = true;
+        m_commitCv.notify_one();
+    }
+
+    if (m_commitThread.joinable()) { m_commitThread.join(); }
+
+#ifndef _WIN32
+    lock_guard lg(m_mtx);
+
+    if (m_map)
+    {
+        msync(m_map, m_mapSize, MS_SYNC);
+        munmap(m_map, m_mapSize);
+        ::close(m_fd); // releases the lock
+    }
+
+    m_filename.clear();
+    m_fd = -1;
+    m_map = nullptr;
+    m_mapSize = 0;
+    m_ring = nullptr;
+    m_capacity = 0;
+    m_live.clear();
+#endif
+}
+
+uint64_t curl::Spool::append(const curl::Request& req, const curl::Priority& priority)
+{
+    const std::string url = req.url();
+    const size_t size = encodedSize(req, url);
+    const size_t need = align8(sizeof(RecordHeader) + size);
+
+    lock_guard lg(m_mtx);
+
+    if (!m_map || (size > UINT32_MAX) || (need > m_capacity)) { return 0; }
+
+    size_t offset = m_tail;
+    bool wrap = ((offset + need) > m_capacity);
+
+    // the tail never reaches the head, otherwise a full ring could not be told from an empty one
+    if (!m_live.empty())
+    {
+        const size_t head = m_live.front().offset;
+
+        if (offset > head)
+        {
+            if (wrap && (need >= head)) { return 0; }
+        }
+        else if ((offset + need) >= head) { return 0; }
+    }
+
+    if (wrap)
+    {
+        if ((m_capacity - offset) >= sizeof(RecordHeader)) { std::memcpy(m_ring + offset, &wrapMagic, sizeof(wrapMagic)); }
+        offset = 0;
+    }
+
+    char* const payload = m_ring + offset + sizeof(RecordHeader);
+    encode(payload, req, url, priority);
+
+    RecordHeader rh;
+    rh.magic = recordMagic;
+    rh.size = (uint32_t)size;
+    rh.seq = m_nextSeq;
+    rh.crc = recordCrc(rh.size, rh.seq, payload);
+    rh.state = statePending;
+    std::memset(rh.reserved, 0, sizeof(rh.reserved));
+    std::memcpy(m_ring + offset, &rh, sizeof(rh));
+
+    m_live.push_back(Live{ offset, need, m_nextSeq, false });
+    m_tail = offset + need;
+    ++m_nextSeq;
+
+    if (!m_dirty)
+    {
+        m_dirty = true;
+        m_commitCv.notify_one();
+    }
+
+    return rh.seq;
+}
+
+void curl::Spool::trim(uint64_t seq)
+{
+    lock_guard lg(m_mtx);
+
+    if (!m_map || m_live.empty() || (seq < m_live.front().seq)) { return; }
+
+    const size_t i = (size_t)(seq - m_live.front().seq);
+    if ((i >= m_live.size()) || m_live[i].done) { return; }
+
+    m_live[i].done = true;
+    m_ring[m_live[i].offset + offsetof(RecordHeader, state)] = (char)stateDone;
+
+    if (i == 0)
+    {
+        while (!m_live.empty() && m_live.front().done) { m_live.pop_front(); }
+        m_writeHead();
+    }
+
+    if (!m_dirty)
+    {
+        m_dirty = true;
+        m_commitCv.notify_one();
+    }
+}
+
+uint64_t curl::Spool::commits() const
+{
+    lock_guard lg(m_mtx);
+    return m_commits;
+}
+
+/**
+ * Reads the records from the head on and sets up the ring.
+ */
+bool curl::Spool::m_recover(std::vector<Spool::Record>* pending)
+{
+    FileHeader fh;
+    std::memcpy(&fh, m_map, sizeof(fh));
+
+    const auto validSlot = [this](const HeadSlot& slot) {
+        return ((slot.crc == slotCrc(slot)) && (slot.seq > 0) && (slot.offset < m_capacity) && ((slot.offset % 8) == 0));
+    };
+    const bool valid0 = validSlot(fh.slots[0]);
+    const bool valid1 = validSlot(fh.slots[1]);
+
+    if (!valid0 && !valid1) { return false; }
+
+    // the slot which has been written last, the other one is valid if that write has been torn
+    const size_t newest = ((valid0 && valid1) ? (fh.slots[1].seq > fh.slots[0].seq ? 1 : 0) : (valid1 ? 1 : 0));
+    const HeadSlot& head = fh.slots[newest];
+    m_headWrites = newest + 1;
+
+    size_t offset = (size_t)head.offset;
+    size_t end = offset;
+    uint64_t seq = head.seq;
+    size_t scanned = 0; // a lap at most
+
+    while (scanned < m_capacity)
+    {
+        if ((m_capacity - offset) < sizeof(RecordHeader))
+        {
+            scanned += m_capacity - offset;
+            offset = 0;
+            continue;
+        }
+
+        RecordHeader rh;
+        std::memcpy(&rh, m_ring + offset, sizeof(rh));
+
+        if (rh.magic == wrapMagic)
+        {
+            scanned += m_capacity - offset;
+            offset = 0;
+            continue;
+        }
+
+        if ((rh.magic != recordMagic) || (rh.seq != seq) || (rh.size > (m_capacity - offset - sizeof(RecordHeader)))) { break; }
+
+        const char* const payload = m_ring + offset + sizeof(RecordHeader);
+        if (rh.crc != recordCrc(rh.size, rh.seq, payload)) { break; }
+
+        const size_t need = align8(sizeof(RecordHeader) + rh.size);
+        scanned += need;
+        if (scanned > m_capacity) { break; }
+
+        // records which can't be decoded are skipped
+        bool done = (rh.state != statePending);
+        if (!done && pending && !decode(payload, rh.size, rh.seq, pending)) { done = true; }
+
+        m_live.push_back(Live{ offset, need, seq, done });
+
+        offset += need;
+        end = offset;
+        ++seq;
+    }
+
+    m_tail = end;
+    m_nextSeq = seq;
+
+    while (!m_live.empty() && m_live.front().done) { m_live.pop_front(); }
+    m_writeHead();
+
+    return true;
+}
+
+/**
+ * Writes the head to the slot which has not been written last.
+ */
+void curl::Spool::m_writeHead()
+{
+    HeadSlot slot;
+    slot.offset = (m_live.empty() ? (m_tail < m_capacity ? m_tail : 0) : m_live.front().offset);
+    slot.seq = (m_live.empty() ? m_nextSeq : m_live.front().seq);
+    slot.crc = slotCrc(slot);
+    slot.reserved = 0;
+
+    const size_t i = (m_headWrites++ % 2);
+    std::memcpy(m_map + offsetof(FileHeader, slots) + (i * sizeof(HeadSlot)), &slot, sizeof(slot));
+}
+
+/**
+ * Syncs the mapping `m_commitInterval_ms` after it has become dirty.
+ */
+void curl::Spool::m_commitLoop()
+{
+    std::unique_lock<std::mutex> lock(m_mtx);
+
+    while (!m_stop)
+    {
+        m_commitCv.wait(lock, [this]() { return (m_dirty || m_stop); });
+        if (m_stop) { break; }
+
+        // the appends of this interval are committed together
+        m_commitCv.wait_for(lock, std::chrono::milliseconds(m_commitInterval_ms), [this]() { return m_stop; });
+
+        m_dirty = false;
+        ++m_commits;
+
+        lock.unlock();
+#ifndef _WIN32
+        msync(m_map, m_mapSize, MS_SYNC);
+#endif
+        lock.lock();
+    }
+}
@@ -0,0 +1,275 @@
+/*
+author          Oliver Blaser
+date            18.10.2026
+copyright       MIT - Copyright (c) 2026 Oliver Blaser
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../include/curl-thread/trace.h"
+
+
+namespace {
+
+static_assert((CURLTHREAD_CONFIG_TRACE_CAPACITY > 0) && ((CURLTHREAD_CONFIG_TRACE_CAPACITY & (CURLTHREAD_CONFIG_TRACE_CAPACITY - 1)) == 0),
+              "CURLTHREAD_CONFIG_TRACE_CAPACITY has to be a power of two");
+
+/**
+ * A record is stored as 4 words. Every slot is guarded by a sequence number (per slot seqlock), which is odd while the
+ * slot is being written. All accesses are atomic, so a reader racing a writer gets a torn record at worst, which is
+ * detected by the sequence number and skipped.
+ *
+ * w2: | tid (32) | queueId (24) | event (8) |
+ */
+struct Slot
+{
+    std::atomic<uint64_t> seq;
+    std::atomic<uint64_t> ts;
+    std::atomic<uint64_t> dur;
+    std::atomic<uint64_t> w2;
+    std::atomic<uintptr_t> name;
+};
+
+struct Record
+{
+    int64_t ts;
+    int64_t dur;
+    curl::trace::Event event;
+    int queueId;
+    uint32_t tid;
+    const char* name;
+};
+
+Slot ring[CURLTHREAD_CONFIG_TRACE_CAPACITY]; // zero initialised, seq 0 marks a slot as empty
+std::atomic<uint64_t> head(0);
+
+uint32_t threadId()
+{
+    static thread_local const uint32_t tid = (uint32_t)std::hash<std::thread::id>()(std::this_thread::get_id());
+    return tid;
+}
+
+const char* eventName(curl::trace::Event event)
+{
+    const char* name = "?";
+
+    switch (event)
+    {
+    case curl::trace::Event::queued:
+        name = "queued";
+        break;
+
+    case curl::trace::Event::dispatched:
+        name = "dispatched";
+        break;
+
+    case curl::trace::Event::dns:
+        name = "DNS";
+        break;
+
+    case curl::trace::Event::connect:
+        name = "connect";
+        break;
+
+    case curl::trace::Event::tls:
+        name = "TLS";
+        break;
+
+    case curl::trace::Event::firstByte:
+        name = "first byte";
+        break;
+
+    case curl::trace::Event::transfer:
+        name = "transfer";
+        break;
+
+    case curl::trace::Event::retry:
+        name = "retry";
+        break;
+
+    case curl::trace::Event::done:
+        name = "done";
+        break;
+
+    case curl::trace::Event::popped:
+        name = "popped";
+        break;
+
+    case curl::trace::Event::state:
+        name = "state";
+        break;
+    }
+
+    return name;
+}
+
+std::string us(int64_t t_ns)
+{
+    // µs with ns resolution, the format Chrome trace JSON expects
+    char buffer[32];
+    const int64_t a = (t_ns < 0 ? -t_ns : t_ns);
+    snprintf(buffer, sizeof(buffer), "%s%lli.%03i", (t_ns < 0 ? "-" : ""), (long long)(a / 1000), (int)(a % 1000));
+    return buffer;
+}
+
+std::string asyncEvent(const char* ph, const char* name, const Record& r)
+{
+    return std::string("{\"ph\":\"") + ph + "\",\"cat\":\"request\",\"name\":\"" + name + "\",\"id\":" + std::to_string(r.queueId) +
+           ",\"pid\":1,\"tid\":" + std::to_string(r.tid) + ",\"ts\":" + us(r.ts) + "}";
+}
+
+std::string completeEvent(const char* name, const Record& r, bool withQueueId)
+{
+    std::string str = std::string("{\"ph\":\"X\",\"cat\":\"worker\",\"name\":\"") + name + "\",\"pid\":1,\"tid\":" + std::to_string(r.tid) +
+                      ",\"ts\":" + us(r.ts) + ",\"dur\":" + us(r.dur);
+    if (withQueueId) { str += ",\"args\":{\"queueId\":" + std::to_string(r.queueId) + "}"; }
+    return str + "}";
+}
+
+} // namespace
+
+
+
+std::atomic<bool> curl::trace::detail::enabled(false);
+
+void curl::trace::enable() { detail::enabled.store(true); }
+void curl::trace::disable() { detail::enabled.store(false); }
+
+void curl::trace::clear()
+{
+    for (size_t i = 0; i < CURLTHREAD_CONFIG_TRACE_CAPACITY; ++i) { ring[i].seq.store(0, std::memory_order_relaxed); }
+    head.store(0);
+}
+
+int64_t curl::trace::now() { return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count(); }
+
+void curl::trace::record(Event event, int queueId, int64_t ts_ns, int64_t dur_ns, const char* name)
+{
+    if (!enabled()) { return; }
+
+    const uint64_t n = head.fetch_add(1, std::memory_order_relaxed);
+    Slot& slot = ring[n & (CURLTHREAD_CONFIG_TRACE_CAPACITY - 1)];
+
+    const uint64_t w2 = ((uint64_t)threadId() << 32) | (((uint64_t)(uint32_t)queueId & 0x00FFFFFF) << 8) | (uint64_t)event;
+
+    slot.seq.store((2 * n) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.ts.store((uint64_t)ts_ns, std::memory_order_relaxed);
+    slot.dur.store((uint64_t)dur_ns, std::memory_order_relaxed);
+    slot.w2.store(w2, std::memory_order_relaxed);
+    slot.name.store((uintptr_t)name, std::memory_order_relaxed);
+    slot.seq.store((2 * n) + 2, std::memory_order_release);
+}
+
+std::string curl::trace::toChromeJson()
+{
+    std::vector<Record> records;
+
+    const uint64_t end = head.load(std::memory_order_acquire);
+    const uint64_t begin = (end > CURLTHREAD_CONFIG_TRACE_CAPACITY ? end - CURLTHREAD_CONFIG_TRACE_CAPACITY : 0);
+    records.reserve((size_t)(end - begin));
+
+    for (uint64_t n = begin; n < end; ++n)
+    {
+        const Slot& slot = ring[n & (CURLTHREAD_CONFIG_TRACE_CAPACITY - 1)];
+
+        const uint64_t seq = slot.seq.load(std::memory_order_acquire);
+        if (seq != ((2 * n) + 2)) { continue; } // empty, being written or already overwritten
+
+        Record r;
+        r.ts = (int64_t)slot.ts.load(std::memory_order_relaxed);
+        r.dur = (int64_t)slot.dur.load(std::memory_order_relaxed);
+        const uint64_t w2 = slot.w2.load(std::memory_order_relaxed);
+        r.name = (const char*)slot.name.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) != seq) { continue; }
+
+        r.event = (Event)(w2 & 0xFF);
+        r.queueId = (int)(((int32_t)(uint32_t)(w2 & 0xFFFFFF00)) >> 8); // sign extend the 24bit value
+        r.tid = (uint32_t)(w2 >> 32);
+
+        records.push_back(r);
+    }
+
+    std::stable_sort(records.begin(), records.end(), [](const Record& a, const Record& b) { return (a.ts < b.ts); });
+
+    std::string str = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    auto append = [&str, &first](const std::string& ev) {
+        if (!first) { str += ",\n"; }
+        first = false;
+        str += ev;
+    };
+
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+        const Record& r = records[i];
+
+        switch (r.event)
+        {
+        case Event::queued:
+            append(asyncEvent("b", "queued", r));
+            break;
+
+        case Event::dispatched:
+            append(asyncEvent("e", "queued", r));
+            append(asyncEvent("b", "transfer", r));
+            break;
+
+        case Event::retry:
+            // backing off counts as queued
+            append(asyncEvent("e", "transfer", r));
+            append(asyncEvent("b", "queued", r));
+            break;
+
+        case Event::done:
+            append(asyncEvent("e", "transfer", r));
+            append(asyncEvent("b", "awaitPop", r));
+            break;
+
+        case Event::popped:
+            append(asyncEvent("e", "awaitPop", r));
+            break;
+
+        case Event::dns:
+        case Event::connect:
+        case Event::tls:
+        case Event::firstByte:
+        case Event::transfer:
+            append(completeEvent(eventName(r.event), r, true));
+            break;
+
+        case Event::state:
+            append(completeEvent((r.name ? r.name : eventName(r.event)), r, false));
+            break;
+        }
+    }
+
+    str += "]}\n";
+
+    return str;
+}
+
+bool curl::trace::writeChromeJson(const std::string& filename)
+{
+    bool ok = false;
+
+    FILE* fp = fopen(filename.c_str(), "wb");
+    if (fp)
+    {
+        const std::string json = toChromeJson();
+        ok = (fwrite(json.data(), 1, json.size(), fp) == json.size());
+        ok = (fclose(fp) == 0) && ok;
+    }
+
+    return ok;
+}
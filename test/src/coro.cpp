@@ -0,0 +1,121 @@
+/*
+author          Oliver Blaser
+date            18.10.2026
+copyright       MIT - Copyright (c) 2026 Oliver Blaser
+*/
+
+// Smoke check of the C++20 coroutine interface, built as C++20 while the rest of the tests stay C++11. No network is
+// involved, the fetch goes through the real curl thread with a `file://` URL.
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#include <curl-thread/coro.h>
+#include <curl-thread/curl.h>
+
+#if !defined(CURLTHREAD_CORO_AVAILABLE)
+#error "the coroutine interface is not available, compile as C++20"
+#endif
+
+
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+bool resumedTwice = false;
+
+curl::coro::Task fetchTwice(const curl::coro::Client& client, curl::Response& first, curl::Response& second)
+{
+    first = co_await client.fetch(curl::GetRequest("file:///dev/null"));
+    second = co_await client.fetch(curl::GetRequest("file:///nonexistent/curl-thread-coro"));
+    resumedTwice = true;
+}
+
+curl::coro::Task fetchNever(const curl::coro::Client& client, bool& resumed)
+{
+    (void)co_await client.fetch(curl::GetRequest("http://localhost/never"));
+    resumed = true;
+}
+
+/**
+ * `co_await`s two fetches through `curl::thread()`, resumed by `curl::coro::LoopExecutor::poll()` on this thread.
+ *
+ * @return `false` if the check failed
+ */
+bool check_fetch()
+{
+    std::thread worker(curl::thread);
+
+    curl::coro::LoopExecutor loop;
+    const curl::coro::Client client(loop.executor());
+
+    curl::Response first, second;
+    curl::coro::Task task = fetchTwice(client, first, second);
+
+    const bool suspended = !task.done();
+    size_t jobs = 0;
+
+    const clock_type::time_point t0 = clock_type::now();
+    while (!task.done() && ((clock_type::now() - t0) < std::chrono::seconds(5)))
+    {
+        jobs += loop.poll();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    curl::shutdown();
+    worker.join();
+
+    task.get();
+
+    const bool ok = (suspended && task.done() && resumedTwice && (jobs == 2) && first.curlOk() && !second.curlOk());
+    printf("%-22s %-34s %s, resumed by %zu polled jobs, %s / %s\n", "co_await fetch", "LoopExecutor", (ok ? "ok" : "FAILED"), jobs,
+           first.toString_noBody().c_str(), second.toString_noBody().c_str());
+
+    return ok;
+}
+
+/**
+ * Destroys a task which is suspended at a `co_await`. The request has to be cancelled, i.e. removed from the queue and
+ * its ID released, and the coroutine must not be resumed. There is no worker, so the request stays queued.
+ *
+ * @return `false` if the check failed
+ */
+bool check_cancel()
+{
+    curl::ThreadSharedData sd;
+    curl::coro::LoopExecutor loop;
+    const curl::coro::Client client(loop.executor(), sd);
+
+    bool resumed = false;
+    size_t queued = 0;
+
+    {
+        curl::coro::Task task = fetchNever(client, resumed);
+        queued = sd.getQNormalSize();
+    }
+
+    const size_t jobs = loop.poll();
+    const curl::ThreadSharedData::Request r = sd.popRequest();
+
+    const bool ok = ((queued == 1) && (sd.getQNormalSize() == 0) && !r.queueId().isValid() && (jobs == 0) && !resumed);
+    printf("%-22s %-34s %s, %zu queued while suspended, %zu left\n", "co_await cancel", "destroyed Task", (ok ? "ok" : "FAILED"), queued,
+           sd.getQNormalSize());
+
+    return ok;
+}
+
+} // namespace
+
+
+
+int main()
+{
+    bool ok = true;
+
+    ok = check_cancel() && ok;
+    ok = check_fetch() && ok;
+
+    return (ok ? 0 : 1);
+}
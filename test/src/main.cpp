@@ -4,6 +4,7 @@ date            01.03.2025
 copyright       MIT - Copyright (c) 2025 Oliver Blaser
 */
 
+#include <chrono>
 #include <ctime>
 #include <iostream>
 #include <string>
@@ -12,8 +13,14 @@ copyright       MIT - Copyright (c) 2025 Oliver Blaser
 
 #include "middleware/util.h"
 
+#ifndef _WIN32
+#include <poll.h>
+#endif
+
+#include <curl-thread/coro.h>
 #include <curl-thread/curl.h>
 #include <curl-thread/thread.h>
+#include <curl-thread/trace.h>
 
 
 #define LOG_MODULE_LEVEL LOG_LEVEL_DBG
@@ -25,6 +32,7 @@ copyright       MIT - Copyright (c) 2025 Oliver Blaser
 #define LOG_BLU(msg, ...) printf(___LOG_CSI_EL "\033[94m" "[%s] -{ BLU }- " msg "\033[39m" "\n", util::t_to_iso8601_local(std::time(nullptr)).c_str() ___LOG_OPT_VA_ARGS(__VA_ARGS__))
 #define LOG_CYA(msg, ...) printf(___LOG_CSI_EL "\033[96m" "[%s] -{ CYA }- " msg "\033[39m" "\n", util::t_to_iso8601_local(std::time(nullptr)).c_str() ___LOG_OPT_VA_ARGS(__VA_ARGS__))
 #define LOG_MAG(msg, ...) printf(___LOG_CSI_EL "\033[95m" "[%s] -{ MAG }- " msg "\033[39m" "\n", util::t_to_iso8601_local(std::time(nullptr)).c_str() ___LOG_OPT_VA_ARGS(__VA_ARGS__))
+#define LOG_GRN(msg, ...) printf(___LOG_CSI_EL "\033[92m" "[%s] -{ GRN }- " msg "\033[39m" "\n", util::t_to_iso8601_local(std::time(nullptr)).c_str() ___LOG_OPT_VA_ARGS(__VA_ARGS__))
 #define LOG_YEL(msg, ...) printf(___LOG_CSI_EL "\033[93m" "[%s] -{ YEL }- " msg "\033[39m" "\n", util::t_to_iso8601_local(std::time(nullptr)).c_str() ___LOG_OPT_VA_ARGS(__VA_ARGS__))
 // clang-format on
 
@@ -59,6 +67,7 @@ DECLARE_TH_NS(blue)
 DECLARE_TH_NS(cyan)
 DECLARE_TH_NS(magenta)
 DECLARE_TH_NS(yellow)
+DECLARE_TH_NS(green)
 
 
 static std::thread thread_curl;
@@ -66,11 +75,37 @@ static std::thread thread_curl;
 
 int main(int argc, char** argv)
 {
+    curl::trace::enable();
+    curl::setRateLimit("api.agify.io", 1, 3);
+    curl::setCircuitBreaker(curl::CircuitBreakerConfig(3, 60 * 1000));
+    curl::setByteBudget(curl::ByteBudget(8 * 1024 * 1024));
+    {
+        curl::ShedConfig shedding(curl::ShedPolicy::evictLowerPriority, 64);
+        shedding.setReserve(curl::Priority::max, 4);
+        curl::setLoadShedding(shedding);
+    }
+    {
+        // the max priority requests survive a restart
+        curl::SpoolConfig spool;
+        spool.setSpooled(curl::Priority::max);
+        spool.setReplayHandler([](const curl::Request& req, const curl::Response& res) {
+            LOG_INF("replayed %s: %s", req.url().c_str(), res.toString_noBody().c_str());
+        });
+
+        const int replayed = curl::openSpool("curl-thread-spool.bin", spool);
+        if (replayed < 0) { LOG_ERR("failed to open the spool"); }
+        else if (replayed > 0) { LOG_INF("replaying %i requests", replayed); }
+    }
+
+    // connected while the consumers start up
+    curl::warmUp({ "https://api.ipify.org", "https://api.agify.io", "https://celestrak.org", "https://timeapi.io" });
+
     thread_curl = std::thread(curl::thread);
     blue::th = std::thread(blue::fn);
     cyan::th = std::thread(cyan::fn);
     magenta::th = std::thread(magenta::fn);
     yellow::th = std::thread(yellow::fn);
+    green::th = std::thread(green::fn);
 
     const time_t tStart = std::time(nullptr);
     time_t tNow;
@@ -89,23 +124,44 @@ int main(int argc, char** argv)
         m = curl::sharedData.getQMaxSize();
         LOG_INF("shutdown curl thread, queue sizes: %i, %i, %i", n, h, m);
 
-        curl::sharedData.shutdown();
+        // the consumers keep running while the queues are drained
+        curl::shutdown(std::chrono::seconds(10));
         thread_curl.join();
 
         n = curl::sharedData.getQNormalSize();
         h = curl::sharedData.getQHighSize();
         m = curl::sharedData.getQMaxSize();
         LOG_INF("joined curl thread, queue sizes: %i, %i, %i", n, h, m);
+
+        const curl::Stats stats = curl::getStats();
+        LOG_INF("stats: queued %llu, dispatched %llu, retried %llu, completed %llu, rejected %llu", (unsigned long long)stats.queued,
+                (unsigned long long)stats.dispatched, (unsigned long long)stats.retried, (unsigned long long)stats.completed,
+                (unsigned long long)stats.rejected);
+        LOG_INF("byte budget: %llu B used, %llu requests over budget, %llu shed", (unsigned long long)stats.budgetUsed, (unsigned long long)stats.overBudget,
+                (unsigned long long)stats.shed);
+        LOG_INF("hedging: %llu duplicates, %llu won", (unsigned long long)stats.hedged, (unsigned long long)stats.hedgeWins);
+        LOG_INF("spool: %llu spooled, %llu not spooled, %llu commits", (unsigned long long)stats.spooled, (unsigned long long)stats.spoolFull,
+                (unsigned long long)stats.spoolCommits);
+        for (size_t i = 0; i < stats.breakers.size(); ++i)
+        {
+            const auto& b = stats.breakers[i];
+            LOG_INF("circuit breaker %s: %s, rejected %llu", b.host.c_str(), curl::toString(b.state).c_str(), (unsigned long long)b.rejected);
+        }
     }
 
+    curl::trace::disable();
+    if (!curl::trace::writeChromeJson("curl-thread-trace.json")) { LOG_ERR("failed to write trace"); }
+
     blue::sd.terminate();
     cyan::sd.terminate();
     magenta::sd.terminate();
+    green::sd.terminate();
 
     blue::th.join();
     cyan::th.join();
     magenta::th.join();
     yellow::th.join();
+    green::th.join();
 
     LOG_INF("exit");
 
@@ -171,7 +227,8 @@ void blue::fn()
 
         case S_req:
         {
-            const auto req = curl::GetRequest("https://api.agify.io/?name=" + getName(), 10);
+            auto req = curl::GetRequest("https://api.agify.io/?name=" + getName(), 10);
+            req.setRetryPolicy(curl::RetryPolicy(3, 1000)); // agify.io answers 429 if the rate limit is exceeded
             curlId = curl::queueRequest(req, curl::Priority::normal);
             if (curlId.isValid())
             {
@@ -222,6 +279,9 @@ void cyan::fn()
     curl::QueueId curlId;
     time_t tReq = 0;
 
+    // this thread doesn't share the response slot with the others
+    const curl::CompletionQueuePtr queue = curl::makeCompletionQueue();
+
     while (!sd.doTerminate())
     {
         const time_t tNow = std::time(nullptr);
@@ -255,8 +315,10 @@ void cyan::fn()
         {
             static std::string group = "stations";
 
-            const auto req = curl::GetRequest("https://celestrak.org/NORAD/elements/gp.php?GROUP=" + group + "&FORMAT=csv", 10, 1);
-            curlId = curl::queueRequest(req, curl::Priority::normal);
+            auto req = curl::GetRequest("https://celestrak.org/NORAD/elements/gp.php?GROUP=" + group + "&FORMAT=csv", 10, 1);
+            req.setMaxResponseSize(2 * 1024 * 1024);
+            req.setDownloadTempFile();
+            curlId = curl::queueRequest(req, curl::Priority::normal, queue);
             if (curlId.isValid())
             {
                 if (group == "stations") { group = "amateur"; }
@@ -275,16 +337,29 @@ void cyan::fn()
         break;
 
         case S_awaitRes:
-            if (curl::responseReady(curlId))
+        {
+            const std::vector<curl::Completion> completions = queue->wait(std::chrono::milliseconds(10));
+
+            for (size_t i = 0; i < completions.size(); ++i)
             {
-                const auto res = curl::popResponse();
+                const curl::Response& res = completions[i].response();
 
-                if (res.good()) { LOG_TH("[%i] %s", (int)curlId, res.toString().c_str()); }
+                if (res.good())
+                {
+                    // first line of the mapped CSV file
+                    const curl::StringView body = res.bodyView();
+                    size_t lineEnd = 0;
+                    while ((lineEnd < body.size()) && (lineEnd < 200) && (body.data()[lineEnd] != '\n')) { ++lineEnd; }
+
+                    LOG_TH("[%i] %s - %i bytes mapped, %s", (int)curlId, res.toString_noBody().c_str(), (int)body.size(),
+                           std::string(body.data(), lineEnd).c_str());
+                }
                 else { LOG_TH(LOG_SGR_BRED "[%i] request failed: %s", (int)curlId, res.toString().c_str()); }
 
                 state = S_idle;
             }
-            break;
+        }
+        break;
 
         default:
             LOG_ERR("invalid state %i at line %i", state, __LINE__);
@@ -313,7 +388,9 @@ curl::Request generateRequest(curl::Priority* priority)
     if (i == 1) { *priority = curl::Priority::max; }
     else if (i == 3) { *priority = curl::Priority::high; }
     else { *priority = curl::Priority::normal; }
-    const curl::Request req = curl::GetRequest(url[i++], 10);
+    // the universities API is only probed
+    const curl::Request req = ((i == 2) ? curl::Request(curl::HeadRequest(url[i], 10)) : curl::Request(curl::GetRequest(url[i], 10)));
+    ++i;
 
     if (i >= SIZEOF_ARRAY(url)) { i = 0; }
 
@@ -351,43 +428,39 @@ void magenta::fn()
 
         case S_idle:
         {
-            static std::vector<curl::QueueId::id_type> ids;
-
             if ((tNow - tAction) >= 31)
             {
                 curl::Priority prio;
                 const curl::Request req = generateRequest(&prio);
-                const curl::QueueId curlId = curl::queueRequest(req, prio);
+                const curl::QueueId curlId = curl::queueRequest(req, prio, curl::Delivery::completionFd);
 
-                if (curlId.isValid())
-                {
-                    LOG_TH("[%i] %s", (int)curlId, req.toString().c_str());
-                    ids.push_back(curlId);
-                }
+                if (curlId.isValid()) { LOG_TH("[%i] %s", (int)curlId, req.toString().c_str()); }
                 else
                 {
-                    LOG_TH(LOG_SGR_BRED "queue req failed, ID: %s, sd.response.ID: %s", curlId.toString().c_str(),
-                           curl::sharedData.getResponseQueueId().toString().c_str());
+                    LOG_TH(LOG_SGR_BRED "queue req failed, ID: %s", curlId.toString().c_str());
 
                     tAction = tNow;
                 }
             }
 
-            for (size_t i = 0; i < ids.size(); ++i)
-            {
-                const curl::QueueId curlId = ids[i];
+            // checks for completions without polling every ID, a thread which only consumes would block in `poll()`
+#ifndef _WIN32
+            pollfd pfd;
+            pfd.fd = curl::completionFd();
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            if (poll(&pfd, 1, 0) <= 0) { break; }
+#endif
 
-                if (curl::responseReady(curlId))
-                {
-                    const auto res = curl::popResponse();
+            const std::vector<curl::Completion> completions = curl::drainCompletions();
 
-                    if (res.good()) { LOG_TH("[%i] %s", (int)curlId, res.toString().c_str()); }
-                    else { LOG_TH(LOG_SGR_BRED "[%i] request failed: %s", (int)curlId, res.toString().c_str()); }
+            for (size_t i = 0; i < completions.size(); ++i)
+            {
+                const int curlId = completions[i].queueId();
+                const curl::Response& res = completions[i].response();
 
-                    // remove this ID from the vector
-                    ids.erase(ids.begin() + i);
-                    i = (-1);
-                }
+                if (res.good()) { LOG_TH("[%i] %s", curlId, res.toString().c_str()); }
+                else { LOG_TH(LOG_SGR_BRED "[%i] request failed: %s", curlId, res.toString().c_str()); }
             }
         }
         break;
@@ -436,7 +509,9 @@ void yellow::fn()
 
         case S_req:
         {
-            const auto req = curl::GetRequest("https://timeapi.io/api/time/current/zone?timeZone=UTC", 10);
+            auto req = curl::GetRequest("https://timeapi.io/api/time/current/zone?timeZone=UTC", 10);
+            req.setCaptureHeaders(true);
+            req.setHedgePolicy(curl::HedgePolicy(1000, 95)); // duplicated if slower than 95% of the previous ones
             curlId = curl::queueRequest(req, curl::Priority::high);
             if (curlId.isValid())
             {
@@ -457,7 +532,12 @@ void yellow::fn()
             {
                 const auto res = curl::popResponse();
 
-                if (res.good()) { LOG_TH("[%i] %s", (int)curlId, res.toString().c_str()); }
+                if (res.good())
+                {
+                    LOG_TH("[%i] %s", (int)curlId, res.toString().c_str());
+                    LOG_TH("[%i] %i header fields, Content-Type: %s", (int)curlId, (int)res.headers().size(),
+                           res.headers().find("Content-Type").str().c_str());
+                }
                 else { LOG_TH(LOG_SGR_BRED "[%i] request failed: %s", (int)curlId, res.toString().c_str()); }
 
                 if (res.good()) { sd.terminate(); }
@@ -476,3 +556,98 @@ void yellow::fn()
 
     LOG_TH("terminated");
 }
+
+
+
+#undef LOG_TH
+#define LOG_TH LOG_GRN
+
+#if defined(CURLTHREAD_CORO_AVAILABLE)
+static curl::coro::Task green_fetchOnce(const curl::coro::Client& client)
+{
+    const auto req = curl::GetRequest("https://api.ipify.org/?format=json", 10);
+    const curl::Response res = co_await client.fetch(req);
+
+    if (res.good()) { LOG_TH("co_await %s", res.toString().c_str()); }
+    else { LOG_TH(LOG_SGR_BRED "co_await request failed: %s", res.toString().c_str()); }
+}
+#endif
+
+void green::fn()
+{
+    int state = S_init;
+    curl::QueueId curlId;
+
+#if defined(CURLTHREAD_CORO_AVAILABLE)
+    // the coroutine is resumed on this thread
+    curl::coro::LoopExecutor loop;
+    const curl::coro::Client client(loop.executor());
+    curl::coro::Task task;
+#endif
+
+    while (!sd.doTerminate())
+    {
+        switch (state)
+        {
+        case S_init:
+            state = S_boot;
+            break;
+
+        case S_boot:
+            if (curl::sharedData.booted())
+            {
+                sd.setBooted(true);
+                LOG_TH("booted");
+                state = S_req;
+
+#if defined(CURLTHREAD_CORO_AVAILABLE)
+                task = green_fetchOnce(client);
+#endif
+            }
+            break;
+
+        case S_req:
+        {
+            // the timing is done by the curl thread
+            const auto req = curl::GetRequest("https://api.ipify.org/?format=json", 10);
+            curlId = curl::scheduleRecurring(req, curl::Priority::normal, std::chrono::seconds(20), std::chrono::seconds(2));
+            if (curlId.isValid())
+            {
+                LOG_TH("[%i] every 20s %s", (int)curlId, req.toString().c_str());
+                state = S_awaitRes;
+            }
+            else
+            {
+                LOG_TH(LOG_SGR_BRED "schedule req failed, ID: %s", curlId.toString().c_str());
+                util::sleep(1000 * 1000);
+            }
+        }
+        break;
+
+        case S_awaitRes:
+            if (curl::responseReady(curlId))
+            {
+                const auto res = curl::popResponse();
+
+                if (res.good()) { LOG_TH("[%i] %s", (int)curlId, res.toString().c_str()); }
+                else { LOG_TH(LOG_SGR_BRED "[%i] request failed: %s", (int)curlId, res.toString().c_str()); }
+            }
+            break;
+
+        default:
+            LOG_ERR("invalid state %i at line %i", state, __LINE__);
+            util::sleep(5 * 1000 * 1000);
+            break;
+        }
+
+#if defined(CURLTHREAD_CORO_AVAILABLE)
+        loop.poll();
+#endif
+
+        util::sleep(10 * 1000);
+    }
+
+    if (curlId.isValid() && !curl::cancelSchedule(curlId)) { LOG_TH(LOG_SGR_BRED "[%i] cancel failed", (int)curlId); }
+
+    LOG_TH("terminated");
+}